@@ -6,37 +6,134 @@ CREATE TYPE sqlite;
 CREATE FUNCTION sqlite_in(cstring)
 RETURNS sqlite
 AS '$libdir/sqlite', 'sqlite_in'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
 CREATE FUNCTION sqlite_out(sqlite)
 RETURNS cstring
 AS '$libdir/sqlite', 'sqlite_out'
-LANGUAGE C IMMUTABLE STRICT;
+LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_recv(internal)
+RETURNS sqlite
+AS '$libdir/sqlite', 'sqlite_recv'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_send(sqlite)
+RETURNS bytea
+AS '$libdir/sqlite', 'sqlite_send'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
 CREATE TYPE sqlite (
     input = sqlite_in,
     output = sqlite_out,
+    receive = sqlite_recv,
+    send = sqlite_send,
     alignment = int4,
     storage = 'extended',
     internallength = -1
 );
 
+CREATE FUNCTION sqlite_query_support(internal)
+RETURNS internal
+AS '$libdir/sqlite', 'sqlite_query_support'
+LANGUAGE C STRICT PARALLEL SAFE;
+
 CREATE FUNCTION sqlite_query(sqlite, text)
 RETURNS SETOF RECORD
 AS '$libdir/sqlite', 'sqlite_query'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL SAFE
+SUPPORT sqlite_query_support;
 
 CREATE FUNCTION sqlite_exec(sqlite, text)
 RETURNS sqlite
 AS '$libdir/sqlite', 'sqlite_exec'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_query(sqlite, text, VARIADIC "any")
+RETURNS SETOF RECORD
+AS '$libdir/sqlite', 'sqlite_query'
+LANGUAGE C PARALLEL SAFE
+SUPPORT sqlite_query_support;
+
+CREATE FUNCTION sqlite_exec(sqlite, text, VARIADIC "any")
+RETURNS sqlite
+AS '$libdir/sqlite', 'sqlite_exec'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_query_columns(sqlite, text)
+RETURNS record
+AS '$libdir/sqlite', 'sqlite_query_columns'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_query_columns(sqlite, text, VARIADIC "any")
+RETURNS record
+AS '$libdir/sqlite', 'sqlite_query_columns'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_insert(sqlite, text, anyarray)
+RETURNS sqlite
+AS '$libdir/sqlite', 'sqlite_insert'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_agg_transfn(sqlite, text, record)
+RETURNS sqlite
+AS '$libdir/sqlite', 'sqlite_agg_transfn'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_agg_finalfn(sqlite)
+RETURNS sqlite
+AS '$libdir/sqlite', 'sqlite_agg_finalfn'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE AGGREGATE sqlite_agg(text, record) (
+    sfunc = sqlite_agg_transfn,
+    stype = sqlite,
+    finalfunc = sqlite_agg_finalfn,
+    finalfunc_modify = read_write,
+    parallel = safe
+);
+
+CREATE FUNCTION sqlite_dump(sqlite, text DEFAULT NULL)
+RETURNS SETOF text
+AS '$libdir/sqlite', 'sqlite_dump'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_to_arrow(sqlite, text, batch_size int DEFAULT 65536)
+RETURNS bytea
+AS '$libdir/sqlite', 'sqlite_to_arrow'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_explain(sqlite, text, "analyze" bool DEFAULT false, OUT "QUERY PLAN" text)
+RETURNS SETOF text
+AS '$libdir/sqlite', 'sqlite_explain'
+LANGUAGE C STRICT PARALLEL SAFE;
 
 CREATE FUNCTION sqlite_serialize(sqlite)
 RETURNS bytea
 AS '$libdir/sqlite', 'sqlite_serialize'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL SAFE;
 
 CREATE FUNCTION sqlite_deserialize(bytea)
 RETURNS sqlite
 AS '$libdir/sqlite', 'sqlite_deserialize'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION sqlite_stmt_cache_stats(sqlite, OUT hits bigint, OUT misses bigint, OUT entries integer)
+RETURNS record
+AS '$libdir/sqlite', 'sqlite_stmt_cache_stats'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+
+CREATE FUNCTION pg_stat_sqlite(OUT event text, OUT calls bigint, OUT bytes bigint,
+                               OUT total_time float8, OUT stats_reset timestamptz)
+RETURNS SETOF record
+AS '$libdir/sqlite', 'pg_stat_sqlite'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE VIEW pg_stat_sqlite AS SELECT * FROM pg_stat_sqlite();
+
+CREATE FUNCTION pg_stat_sqlite_reset()
+RETURNS void
+AS '$libdir/sqlite', 'pg_stat_sqlite_reset'
 LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION pg_stat_sqlite_reset() FROM PUBLIC;
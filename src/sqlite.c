@@ -1,5 +1,13 @@
 #include "sqlite.h"
 
+#include "access/detoast.h"
+#include "access/xact.h"
+#include "common/base64.h"
+#include "utils/memutils.h"
+
+#include <float.h>
+#include <limits.h>
+
 PG_MODULE_MAGIC;
 
 /* Callback function for freeing sqlite arrays. */
@@ -23,30 +31,55 @@ static const ExpandedObjectMethods sqlite_methods = {
 static Size
 sqlite_get_flat_size(ExpandedObjectHeader *eohptr) {
 	sqlite_Sqlite *db = (sqlite_Sqlite*) eohptr;
-	sqlite3_int64 flat_size;
 
 	LOGF();
 
 	/* This is a sanity check that the object is initialized */
 	Assert(db->em_magic == sqlite_MAGIC);
 
-	/* Use cached value if already computed */
-	if (db->flat_size)
-	{
+	SQLITE_STATS_START(db->flatten_start);
+
+	/* SQLite may write pages of a transaction to the page store before
+	   it commits, so the store only holds a consistent database when
+	   no transaction is open */
+	if (!sqlite3_get_autocommit(db->db))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TRANSACTION_STATE),
+				 errmsg("cannot store a sqlite database with an open transaction"),
+				 errhint("Run COMMIT or ROLLBACK with sqlite_exec() first.")));
+
+	/* The size is asked for more than once per flattening, by
+	   heap_compute_data_size() and heap_fill_tuple() for one, and again
+	   whenever an unchanged database is stored.  Packing it is only
+	   worth doing once. */
+	if (db->flat_size != 0 && db->flat_writes == db->store.writes &&
+		db->flat_compression == sqlite_compression)
 		return db->flat_size;
-	}
 
-	db->flat_data = sqlite3_serialize(db->db, "main", &flat_size, 0);
-	if (db->flat_data == NULL)
+	if (db->packed != NULL)
 	{
-		ereport(ERROR, (errmsg("Failed to serialize sqlite db %s", sqlite3_errmsg(db->db))));
+		pfree(db->packed);
+		db->packed = NULL;
 	}
+	db->flat_writes = db->store.writes;
+	db->flat_compression = sqlite_compression;
 
-	flat_size += SQLITE_OVERHEAD();
-
-	/* Cache this value in the expanded object */
-	db->flat_size = flat_size;
-	return flat_size;
+	/* The database file is the page store, which SQLite has written
+	   every committed change to */
+	if (sqlite_compression != SQLITE_FORMAT_RAW)
+	{
+		Size packed_size;
+
+		db->packed = sqlite_pack(db, sqlite_compression, &packed_size);
+		if (db->packed != NULL)
+		{
+			db->packed_format = sqlite_compression;
+			db->flat_size = packed_size + SQLITE_OVERHEAD();
+			return db->flat_size;
+		}
+	}
+	db->flat_size = db->store.size + SQLITE_OVERHEAD();
+	return db->flat_size;
 }
 
 /* Flatten sqlite into a pre-allocated result buffer that is
@@ -54,8 +87,6 @@ sqlite_get_flat_size(ExpandedObjectHeader *eohptr) {
 static void
 sqlite_flatten_into(ExpandedObjectHeader *eohptr,
 				   void *result, Size allocated_size)  {
-	void *data;
-
 	/* Cast EOH pointer to expanded object, and result pointer to flat
 	   object */
 	sqlite_Sqlite *db = (sqlite_Sqlite *) eohptr;
@@ -67,30 +98,41 @@ sqlite_flatten_into(ExpandedObjectHeader *eohptr,
 	Assert(db->em_magic == sqlite_MAGIC);
 	Assert(allocated_size == db->flat_size);
 
-	/* Zero out the whole allocated buffer */
-	memset(flat, 0, allocated_size);
+	/* Zero out the header padding */
+	memset(flat, 0, SQLITE_OVERHEAD());
 
-	/* Get the pointer to the start of the flattened data and copy the
-	   expanded value into it */
-	data = SQLITE_DATA(flat);
-	memcpy(data, db->flat_data, db->flat_size - SQLITE_OVERHEAD());
+	if (db->packed != NULL)
+	{
+		flat->format = db->packed_format;
+		memcpy(SQLITE_DATA(flat), db->packed, allocated_size - SQLITE_OVERHEAD());
+	}
+	else
+	{
+		/* Copy the pages straight into the flattened data */
+		flat->format = SQLITE_FORMAT_RAW;
+		if (!sqlite_store_read(&db->store, SQLITE_DATA(flat), db->store.size, 0))
+			sqlite_store_read_error(&db->store);
+	}
 
 	/* Set the size of the varlena object */
 	SET_VARSIZE(flat, allocated_size);
+	sqlite_stats_add(SQLITE_STAT_FLATTEN, allocated_size, db->flatten_start);
 }
 
-/* Expand a flat sqlite in to an Expanded one, return as Postgres Datum. */
+/* Create a new empty expanded sqlite whose database file lives in the
+   object's page store.  The store can be given an image with
+   sqlite_store_set_image() before the database is first used. */
 sqlite_Sqlite *
-new_expanded_sqlite(sqlite_FlatSqlite *flat, MemoryContext parentcontext, sqlite3 *existing_db) {
+new_expanded_sqlite(MemoryContext parentcontext, bool readonly) {
 	sqlite_Sqlite *db;
-	sqlite3 *innerdb;
-	size_t flat_size;
-	unsigned char *flat_data;
 	MemoryContext objcxt, oldcxt;
 	MemoryContextCallback *ctxcb;
+	instr_time start;
 
 	LOGF();
 
+	SQLITE_STATS_START(start);
+
 	/* Create a new context that will hold the expanded object. */
 	objcxt = AllocSetContextCreate(parentcontext,
 								   "expanded sqlite",
@@ -110,94 +152,290 @@ new_expanded_sqlite(sqlite_FlatSqlite *flat, MemoryContext parentcontext, sqlite
 	/* Switch to new object context */
 	oldcxt = MemoryContextSwitchTo(objcxt);
 
-	/* Setting flat size to zero tells us the object has been written. */
 	db->flat_size = 0;
-	db->flat_data = NULL;
-
-	if (existing_db != NULL)
-	{
-		innerdb = existing_db;
-	}
-	else if (sqlite3_open(":memory:", &innerdb) != SQLITE_OK)
-	{
-        ereport(ERROR, (errmsg("Failed to create SQLite in-memory database: %s",
-							   sqlite3_errmsg(innerdb))));
-	}
-
-	if (flat != NULL)
-	{
-		flat_size = VARSIZE(flat) - SQLITE_OVERHEAD();
-		flat_data = SQLITE_DATA(flat);
-		sqlite3_deserialize(innerdb, "main", flat_data, flat_size, flat_size,
-							SQLITE_DESERIALIZE_RESIZEABLE);
-	}
-	db->db = innerdb;
+	db->packed = NULL;
+	db->flat_writes = 0;
+	db->flat_compression = SQLITE_FORMAT_RAW;
+	db->readonly = readonly;
+	sqlite_store_init(&db->store, objcxt);
+
+	/* The statement cache is allocated on first use */
+	db->stmt_cache = NULL;
+	db->stmt_cache_size = 0;
+	db->stmt_cache_len = 0;
+	db->stmt_cache_clock = 0;
+	db->stmt_cache_hits = 0;
+	db->stmt_cache_misses = 0;
 
 	/* Create a context callback to free sqlite when context is cleared */
+	db->db = NULL;
+	db->mem = sqlite_mem_account_create();
 	ctxcb = MemoryContextAlloc(objcxt, sizeof(MemoryContextCallback));
 
 	ctxcb->func = sqlite_free_context_callback;
 	ctxcb->arg = db;
 	MemoryContextRegisterResetCallback(objcxt, ctxcb);
 
+	sqlite_mem_enter(db->mem);
+	db->db = sqlite_vfs_open_db(&db->store, readonly);
+	db->restrict_sql = false;
+	db->restrict_denied = false;
+	if (readonly)
+		sqlite3_set_authorizer(db->db, sqlite_readonly_authorizer, db);
+
 	/* Switch back to old context */
 	MemoryContextSwitchTo(oldcxt);
+	sqlite_stats_add(SQLITE_STAT_EXPAND, 0, start);
 	return db;
 }
 
 static void
 sqlite_free_context_callback(void* ptr) {
 	sqlite_Sqlite *db = (sqlite_Sqlite *) ptr;
+	sqlite3_stmt *stmt;
 	LOGF();
-	sqlite3_close(db->db);
+	if (db->db != NULL)
+	{
+		sqlite_mem_enter(db->mem);
+		sqlite_stmt_cache_clear(db);
+
+		/* Statements abandoned by an early exit would keep the db open */
+		while ((stmt = sqlite3_next_stmt(db->db, NULL)) != NULL)
+			sqlite3_finalize(stmt);
+		sqlite3_close(db->db);
+	}
+	sqlite_mem_account_close(db->mem);
 }
 
+/* Expand a varlena holding a database image.
+
+   d is a flat sqlite, or a bytea holding a database file if flat is
+   false.  The value is detoasted straight into the object context and
+   used as the base image of its page store, so pages are only copied
+   when they are written.  A read-only database references a value that
+   is already flat where it is, the caller must keep it alive; a
+   writable one is returned to callers and gets its own copy. */
 sqlite_Sqlite *
-DatumGetSqlite(Datum d) {
+expand_sqlite_datum(Datum d, bool flat, MemoryContext parentcontext, bool readonly)
+{
+	sqlite_Sqlite *db;
+	struct varlena *source = (struct varlena *) DatumGetPointer(d);
+	struct varlena *image;
+	MemoryContext oldcxt;
+	sqlite_FlatSqlite *flatsqlite;
+	instr_time start;
+
+	LOGF();
+
+	SQLITE_STATS_START(start);
+	db = new_expanded_sqlite(parentcontext, readonly);
+
+	oldcxt = MemoryContextSwitchTo(db->hdr.eoh_context);
+	image = pg_detoast_datum(source);
+	if (image == source && !readonly)
+	{
+		image = palloc(VARSIZE(source));
+		memcpy(image, source, VARSIZE(source));
+	}
+	MemoryContextSwitchTo(oldcxt);
+
+	if (!flat)
+	{
+		sqlite_store_set_image(&db->store, (unsigned char *) VARDATA(image),
+							   VARSIZE(image) - VARHDRSZ);
+		sqlite_stats_add(SQLITE_STAT_DESERIALIZE, VARSIZE(image), start);
+		return db;
+	}
+
+	flatsqlite = (sqlite_FlatSqlite *) image;
+	if (VARSIZE(image) < SQLITE_OVERHEAD())
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid sqlite datum size %u", VARSIZE(image))));
+	if (flatsqlite->format == SQLITE_FORMAT_RAW)
+		sqlite_store_set_image(&db->store, SQLITE_DATA(image),
+							   VARSIZE(image) - SQLITE_OVERHEAD());
+	else
+		sqlite_store_set_packed(&db->store, flatsqlite->format, SQLITE_DATA(image),
+								VARSIZE(image) - SQLITE_OVERHEAD());
+	sqlite_stats_add(SQLITE_STAT_DESERIALIZE, VARSIZE(image), start);
+	return db;
+}
+
+/* Whether a read-only database should be read from TOAST on demand
+   rather than detoasted up front.  Slices can only be fetched cheaply
+   from values that TOAST didn't compress.  A fetch runs in a
+   subtransaction, which parallel mode doesn't allow. */
+static bool
+sqlite_lazy_eligible(Datum d)
+{
+	struct varlena *attr = (struct varlena *) DatumGetPointer(d);
+	struct varatt_external toast_pointer;
+
+	if (sqlite_lazy_load_threshold < 0 || !VARATT_IS_EXTERNAL_ONDISK(attr) ||
+		IsInParallelMode())
+		return false;
+
+	VARATT_EXTERNAL_GET_POINTER(toast_pointer, attr);
+	if (VARATT_EXTERNAL_IS_COMPRESSED(toast_pointer))
+		return false;
+	return VARATT_EXTERNAL_GET_EXTSIZE(toast_pointer) >= (Size) sqlite_lazy_load_threshold * 1024;
+}
+
+/* Expand a read-only database whose pages are fetched from TOAST as
+   SQLite reads them, so a query only reads the chunks holding the
+   pages it touches.  SQLite's page cache keeps the pages it reads.
+   Returns NULL for a packed database, which has to be detoasted.
+
+   Slice offsets don't count the varlena header, which TOAST doesn't
+   store. */
+static sqlite_Sqlite *
+expand_sqlite_lazy(Datum d, MemoryContext parentcontext)
+{
+	struct varlena *attr = (struct varlena *) DatumGetPointer(d);
+	struct varatt_external toast_pointer;
+	struct varlena *header;
+	int64 offset = SQLITE_OVERHEAD() - VARHDRSZ;
+	uint32 format;
+	sqlite_Sqlite *db;
+
+	LOGF();
+
+	VARATT_EXTERNAL_GET_POINTER(toast_pointer, attr);
+	header = detoast_attr_slice(attr, 0, sizeof(uint32));
+	if (VARSIZE(header) - VARHDRSZ != sizeof(uint32))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid sqlite datum size")));
+	memcpy(&format, VARDATA(header), sizeof(uint32));
+	pfree(header);
+	if (format != SQLITE_FORMAT_RAW)
+		return NULL;
+
+	db = new_expanded_sqlite(parentcontext, true);
+	sqlite_store_set_toast(&db->store, attr, offset,
+						   VARATT_EXTERNAL_GET_EXTSIZE(toast_pointer) - offset);
+	return db;
+}
+
+/* Copy on write: read-only databases may be shared, so writers get a
+   private writable database with its own copy of the image. */
+sqlite_Sqlite *
+sqlite_copy_writable(sqlite_Sqlite *ro)
+{
+	sqlite_Sqlite *copy = new_expanded_sqlite(CurrentMemoryContext, false);
+	unsigned char *image;
+
+	image = MemoryContextAllocHuge(copy->hdr.eoh_context, ro->store.size);
+	if (!sqlite_store_read(&ro->store, image, ro->store.size, 0))
+		sqlite_store_read_error(&ro->store);
+	sqlite_store_set_image(&copy->store, image, ro->store.size);
+	return copy;
+}
+
+/* Detoast or expand a sqlite datum that the caller will only read. */
+sqlite_Sqlite *
+DatumGetSqliteReadOnly(Datum d) {
 	sqlite_Sqlite *db;
-	sqlite_FlatSqlite *flat;
+	bool lazy;
 	LOGF();
 	if (VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(d))) {
 		db = SqliteGetEOHP(d);
 		Assert(db->em_magic == sqlite_MAGIC);
+		sqlite_mem_enter(db->mem);
 		return db;
 	}
-	flat = (sqlite_FlatSqlite*)PG_DETOAST_DATUM(d);
-	db = new_expanded_sqlite(flat, CurrentMemoryContext, NULL);
+
+	/* Databases read on demand hold too little to be worth caching,
+	   packed ones have to be detoasted and are */
+	lazy = sqlite_lazy_eligible(d);
+	db = sqlite_cache_lookup(d, !lazy);
+	if (db == NULL && lazy &&
+		(db = expand_sqlite_lazy(d, CurrentMemoryContext)) == NULL)
+		db = sqlite_cache_lookup(d, true);
+	if (db == NULL)
+		db = expand_sqlite_datum(d, true, CurrentMemoryContext, true);
+	sqlite_mem_enter(db->mem);
 	return db;
 }
 
+sqlite_Sqlite *
+DatumGetSqlite(Datum d) {
+	sqlite_Sqlite *db;
+	LOGF();
+	if (VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(d))) {
+		db = SqliteGetEOHP(d);
+		Assert(db->em_magic == sqlite_MAGIC);
+		if (db->readonly)
+			return sqlite_copy_writable(db);
+		sqlite_mem_enter(db->mem);
+		return db;
+	}
+
+	/* A cached image saves detoasting, though a writable copy is needed */
+	db = sqlite_cache_lookup(d, false);
+	if (db != NULL)
+		return sqlite_copy_writable(db);
+
+	return expand_sqlite_datum(d, true, CurrentMemoryContext, false);
+}
+
+/* Text form of a database in the image output format: the marker,
+   followed by the database file image in base64.  The SQL form can
+   never start with the marker, as it isn't valid SQL. */
+#define SQLITE_IMAGE_MARKER "sqlite+base64:"
+
+int sqlite_output_format = SQLITE_OUTPUT_SQL;
+
+/* Decode the image output format */
+static sqlite_Sqlite *
+sqlite_in_image(const char *encoded)
+{
+	int len = strlen(encoded);
+	char *image;
+	int size;
+
+	image = palloc(pg_b64_dec_len(len));
+	size = pg_b64_decode((void *) encoded, len, (void *) image, pg_b64_dec_len(len));
+	if (size < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+				 errmsg("invalid base64 sqlite database image")));
+	return sqlite_deserialize_image(image, size);
+}
+
 PG_FUNCTION_INFO_V1(sqlite_in);
 Datum
 sqlite_in(PG_FUNCTION_ARGS) {
     char *query = PG_GETARG_CSTRING(0);
 	sqlite_Sqlite *sqlite;
-    sqlite3 *db;
     char *msg = NULL;
 
 	LOGF();
 
-    // Initialize SQLite in-memory database
-    if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+	/* Either output format is accepted whatever the setting */
+	if (strncmp(query, SQLITE_IMAGE_MARKER, strlen(SQLITE_IMAGE_MARKER)) == 0)
 	{
-        ereport(ERROR, (errmsg("Failed to create SQLite in-memory database: %s",
-							   sqlite3_errmsg(db))));
-    }
+		sqlite = sqlite_in_image(query + strlen(SQLITE_IMAGE_MARKER));
+		SQLITE_RETURN(sqlite);
+	}
+
+    // Initialize SQLite in-memory database
+ 	sqlite = new_expanded_sqlite(CurrentMemoryContext, false);
 
     // Execute the query
-    if (sqlite3_exec(db, query, NULL, NULL, &msg) != SQLITE_OK)
+    if (sqlite3_exec(sqlite->db, query, NULL, NULL, &msg) != SQLITE_OK)
 	{
         ereport(ERROR, (errmsg("Failed to execute query: %s", msg)));
     }
 
- 	sqlite = new_expanded_sqlite(NULL, CurrentMemoryContext, db);
     SQLITE_RETURN(sqlite);
 }
 
-int asi_callback(const char *str, void *sinfo);
-int asi_callback(const char *str, void *sinfo)
+int asi_callback(const char *str, int len, void *sinfo);
+int asi_callback(const char *str, int len, void *sinfo)
 {
-	appendStringInfo(*(StringInfo*)sinfo, "%s", str);
+	appendBinaryStringInfo(*(StringInfo*)sinfo, str, len);
 	return 1;
 }
 
@@ -207,24 +445,218 @@ sqlite_out(PG_FUNCTION_ARGS)
 {
 	sqlite_Sqlite *db;
 	StringInfo dump;
+	instr_time start;
 
 	LOGF();
 
-	db = SQLITE_GETARG(0);
+	db = SQLITE_GETARG_RO(0);
+	SQLITE_STATS_START(start);
+
+	if (sqlite_output_format == SQLITE_OUTPUT_IMAGE)
+	{
+		bytea *image = sqlite_serialize_image(db);
+		int size = VARSIZE(image) - VARHDRSZ;
+		Size marker_len = strlen(SQLITE_IMAGE_MARKER);
+		Size enc_len = pg_b64_enc_len(size);
+		char *result;
+		int len;
+
+		if (marker_len + enc_len + 1 > MaxAllocSize)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("sqlite database is too large for the image output format")));
+
+		result = palloc(marker_len + enc_len + 1);
+		memcpy(result, SQLITE_IMAGE_MARKER, marker_len);
+		len = pg_b64_encode((void *) VARDATA(image), size, result + marker_len, enc_len);
+		if (len < 0)
+			elog(ERROR, "could not encode sqlite database image");
+		result[marker_len + len] = '\0';
+		pfree(image);
+		sqlite_stats_add(SQLITE_STAT_DUMP, marker_len + len, start);
+		PG_RETURN_CSTRING(result);
+	}
+
 	dump = makeStringInfo();
 	if (sqlite3_db_dump(db->db, "main", NULL, asi_callback, (void*)&dump) != SQLITE_OK)
 	{
+		sqlite_store_check_error(&db->store);
         ereport(ERROR, (errmsg("Failed to dump sqlite: %s",
 							   sqlite3_errmsg(db->db))));
 	}
+	sqlite_stats_add(SQLITE_STAT_DUMP, dump->len, start);
 
     PG_RETURN_CSTRING(dump->data);
 }
 
+static const struct config_enum_entry sqlite_compression_options[] = {
+	{"none", SQLITE_FORMAT_RAW, false},
+	{"pglz", SQLITE_FORMAT_PGLZ, false},
+#ifdef USE_LZ4
+	{"lz4", SQLITE_FORMAT_LZ4, false},
+#endif
+#ifdef USE_ZSTD
+	{"zstd", SQLITE_FORMAT_ZSTD, false},
+#endif
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry sqlite_output_format_options[] = {
+	{"sql", SQLITE_OUTPUT_SQL, false},
+	{"image", SQLITE_OUTPUT_IMAGE, false},
+	{NULL, 0, false}
+};
+
 void
 _PG_init(void)
 {
 	LOGF();
+
+	/* The allocator has to be in place before SQLite initializes */
+	sqlite_mem_init();
+	sqlite_vfs_register();
+	sqlite_stats_init();
+	sqlite_pushdown_init();
+
+	DefineCustomIntVariable("sqlite.statement_cache_size",
+							"Maximum number of prepared statements cached per sqlite database.",
+							NULL,
+							&sqlite_stmt_cache_size,
+							16,
+							0,
+							1024,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("sqlite.cache_size",
+							"Memory available to the backend cache of databases read from TOAST storage.",
+							"Counts the database images and the memory SQLite holds for them, approximately. Set to 0 to disable the cache.",
+							&sqlite_cache_size,
+							65536,
+							0,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("sqlite.lazy_load_threshold",
+							"Size above which read-only databases are read from TOAST on demand.",
+							"Only applies to databases stored out of line without TOAST compression. Set to -1 to always detoast.",
+							&sqlite_lazy_load_threshold,
+							1024,
+							-1,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomEnumVariable("sqlite.compression",
+							 "Compresses sqlite databases page by page when they are stored.",
+							 "Freelist pages are dropped and unused space in pages is zeroed first.",
+							 &sqlite_compression,
+							 SQLITE_FORMAT_RAW,
+							 sqlite_compression_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("sqlite.max_memory_per_db",
+							"Maximum memory SQLite may use for each sqlite database.",
+							"Queries that need more fail with an out of memory error. The page cache of databases opened after it is set gets half of it. Set to 0 for no limit.",
+							&sqlite_max_memory_per_db,
+							0,
+							0,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("sqlite.soft_heap_limit",
+							"Memory SQLite tries to stay below in each backend.",
+							"SQLite frees cached pages to stay below the limit, but may exceed it. Set to 0 for no limit.",
+							&sqlite_soft_heap_limit,
+							0,
+							0,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							sqlite_mem_assign_soft_heap_limit,
+							NULL);
+
+	DefineCustomEnumVariable("sqlite.output_format",
+							 "Sets the text output format of sqlite databases.",
+							 "sql outputs a SQL dump, image the database file in base64, "
+							 "which loads without running any SQL.",
+							 &sqlite_output_format,
+							 SQLITE_OUTPUT_SQL,
+							 sqlite_output_format_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("sqlite.query_rows",
+							"Sets the planner's estimate of the rows of a sqlite_query() call.",
+							"Used when the rows can't be estimated from the plan and statistics of the database.",
+							&sqlite_query_rows,
+							1000,
+							1,
+							INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomRealVariable("sqlite.query_cost",
+							 "Sets the planner's estimate of the cost of each row of a sqlite_query() call.",
+							 "In units of cpu_operator_cost.  A call costs this times the rows it is estimated to return.",
+							 &sqlite_query_cost,
+							 1.0,
+							 0.0,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("sqlite.enable_pushdown",
+							 "Pushes quals, ORDER BY and LIMIT down into sqlite_query() calls.",
+							 NULL,
+							 &sqlite_enable_pushdown,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("sqlite.track_timing",
+							 "Collects timing statistics of sqlite events.",
+							 "Reading the clock for every statement step can be costly.",
+							 &sqlite_track_timing,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	MarkGUCPrefixReserved("sqlite");
 }
 
 /* Local Variables: */
@@ -8,6 +8,8 @@
 #include "utils/lsyscache.h"
 #include "utils/builtins.h"
 #include "lib/stringinfo.h"
+#include "utils/guc.h"
+#include "portability/instr_time.h"
 
 #include <sqlite3.h>
 
@@ -19,43 +21,406 @@
 /* Flattened representation of sqlite, used to store to disk.
 
    The first 32 bits must the length of the data.  Actual flattened data
-   is appended after this struct and cannot exceed 1GB.
+   is appended after this struct and cannot exceed 1GB.  format says how
+   the data is stored, one of the SQLITE_FORMAT_* values below.  Values
+   written before the format word existed have zero there, since the
+   header was padded to MAXALIGN.
 */
 typedef struct sqlite_FlatSqlite {
 	int32 vl_len_;
+	uint32 format;
 } sqlite_FlatSqlite;
 
+/* The data is the SQLite database file as is */
+#define SQLITE_FORMAT_RAW 0
+/* The data is a sqlite_PackedImage with pages compressed by pglz */
+#define SQLITE_FORMAT_PGLZ 1
+/* Same, compressed by lz4 */
+#define SQLITE_FORMAT_LZ4 2
+/* Same, compressed by zstd */
+#define SQLITE_FORMAT_ZSTD 3
+
+/* A database file stored page by page, see sqlite_pack.c.
+
+   Page i (zero based) is stored in the data following offsets[npages],
+   from offsets[i] to offsets[i + 1].  An empty page is all zeros and a
+   page of page_size bytes is stored uncompressed.
+*/
+typedef struct sqlite_PackedImage {
+	uint32 page_size;
+	uint32 npages;
+	uint32 offsets[FLEXIBLE_ARRAY_MEMBER];
+} sqlite_PackedImage;
+
+#define SQLITE_PACKED_DATA(p) ((const unsigned char *) &(p)->offsets[(p)->npages + 1])
+
+/* Size of the pages a page store keeps the database file in */
+#define SQLITE_STORE_PAGE_SIZE 4096
+
+/* Storage for the database file of an expanded sqlite, see sqlite_vfs.c.
+
+   pages[] holds private copies of pages that were written, allocated
+   in cxt.  Any other page below image_size is read from image, or
+   decompressed from packed when the image is stored in pages.
+*/
+typedef struct sqlite_PageStore {
+	MemoryContext cxt;
+	int64 size;
+	int64 npages;
+	int64 maxpages;
+	unsigned char **pages;
+	const unsigned char *image;
+	Size image_size;
+	/* Packed image and its SQLITE_FORMAT_* */
+	const sqlite_PackedImage *packed;
+	int format;
+	/* The last page decompressed from packed */
+	unsigned char *unpacked;
+	int64 unpacked_pgno;
+	/* TOAST pointer the image is fetched from on demand instead, and
+	   where the database file starts in the value */
+	struct varlena *toast;
+	int64 toast_offset;
+	/* The last slice fetched from toast */
+	unsigned char *window;
+	int64 window_start;
+	int64 window_len;
+	/* Error raised by a read from inside SQLite, for the caller to
+	   rethrow once SQLite has returned */
+	ErrorData *error;
+	/* Number of writes and truncations, which only happen when SQLite
+	   commits a change to the database file */
+	uint64 writes;
+} sqlite_PageStore;
+
+/* A prepared statement held in the per-database statement cache.
+
+   Entries are keyed by the SQL text they were prepared from.  A
+   statement that is currently being stepped is marked in_use so that
+   a nested use of the same SQL on the same database gets its own
+   statement instead of resetting this one underneath its owner.
+   subxid is the subtransaction it is in use by, so an abort can hand
+   back the statements of the scans it cut short.
+*/
+typedef struct sqlite_CachedStmt {
+	char *sql;
+	sqlite3_stmt *stmt;
+	int tail_offset;
+	uint64 last_used;
+	bool in_use;
+	SubTransactionId subxid;
+} sqlite_CachedStmt;
+
 /* Expanded representation of sqlite.
 
    When loaded from storage, the flattened representation is used to
    build the sqlite.  In this case, it's just a pointer to an integer.
 */
+/* Memory SQLite holds for a database, see sqlite_mem.c */
+typedef struct sqlite_MemAccount sqlite_MemAccount;
+
 typedef struct sqlite_Sqlite  {
 	ExpandedObjectHeader hdr;
 	int em_magic;
 	sqlite3 *db;
+	sqlite_MemAccount *mem;
 	Size flat_size;
-	unsigned char *flat_data;
+	/* Database packed by sqlite_get_flat_size() for sqlite_flatten_into(),
+	   kept with flat_size until the store is written again or another
+	   compression is asked for */
+	unsigned char *packed;
+	int packed_format;
+	uint64 flat_writes;
+	int flat_compression;
+	/* When sqlite_get_flat_size() began flattening */
+	instr_time flatten_start;
+	/* Read-only databases may be shared and must never be written */
+	bool readonly;
+	/* Set while SQL of the caller is prepared on a read-only database,
+	   which may then only read, see sqlite_readonly_authorizer() */
+	bool restrict_sql;
+	bool restrict_denied;
+	/* The database file */
+	sqlite_PageStore store;
+	/* LRU cache of prepared statements, see sqlite_stmtcache.c */
+	sqlite_CachedStmt *stmt_cache;
+	int stmt_cache_size;
+	int stmt_cache_len;
+	uint64 stmt_cache_clock;
+	uint64 stmt_cache_hits;
+	uint64 stmt_cache_misses;
 } sqlite_Sqlite;
 
-/* Create a new sqlite datum. */
+/* Maximum number of statements cached per database (sqlite.statement_cache_size) */
+extern int sqlite_stmt_cache_size;
+
+/* Create a new, empty sqlite datum. */
+sqlite_Sqlite *
+new_expanded_sqlite(MemoryContext parentcontext, bool readonly);
+
+/* Expand a flat sqlite, or a bytea holding a database file if flat is
+   false, into a sqlite datum. */
 sqlite_Sqlite *
-new_expanded_sqlite(sqlite_FlatSqlite* flat, MemoryContext parentcontext, sqlite3 *existing_db);
+expand_sqlite_datum(Datum d, bool flat, MemoryContext parentcontext, bool readonly);
+
+/* Page store and VFS, see sqlite_vfs.c */
+void
+sqlite_vfs_register(void);
+
+sqlite3 *
+sqlite_vfs_open_db(sqlite_PageStore *store, bool readonly);
+
+void
+sqlite_store_init(sqlite_PageStore *store, MemoryContext cxt);
+
+void
+sqlite_store_set_image(sqlite_PageStore *store, const unsigned char *image, Size size);
+
+void
+sqlite_store_set_toast(sqlite_PageStore *store, struct varlena *toast, int64 offset, int64 size);
+
+bool
+sqlite_store_read(sqlite_PageStore *store, unsigned char *buf, int64 amount, int64 offset);
+
+/* Raise the error behind a failed sqlite_store_read() */
+void
+sqlite_store_read_error(sqlite_PageStore *store);
+
+/* Rethrow an error a read raised while SQLite was running, if any */
+void
+sqlite_store_check_error(sqlite_PageStore *store);
+
+/* Size in kB above which read-only databases are read from TOAST on
+   demand (sqlite.lazy_load_threshold) */
+extern int sqlite_lazy_load_threshold;
+
+/* SQLite memory allocation, see sqlite_mem.c */
+
+/* Memory limit in kB of each database (sqlite.max_memory_per_db) */
+extern int sqlite_max_memory_per_db;
+
+/* Limit in kB of all SQLite memory in the backend (sqlite.soft_heap_limit) */
+extern int sqlite_soft_heap_limit;
+
+void
+sqlite_mem_init(void);
+
+void
+sqlite_mem_assign_soft_heap_limit(int newval, void *extra);
+
+sqlite_MemAccount *
+sqlite_mem_account_create(void);
+
+void
+sqlite_mem_enter(sqlite_MemAccount *account);
+
+void
+sqlite_mem_account_close(sqlite_MemAccount *account);
+
+Size
+sqlite_mem_account_used(sqlite_MemAccount *account);
+
+/* Compressed page format, see sqlite_pack.c */
+
+/* Page compression for new flat sqlites (sqlite.compression) */
+extern int sqlite_compression;
+
+unsigned char *
+sqlite_pack(sqlite_Sqlite *db, int format, Size *size);
+
+bool
+sqlite_unpack_page(const sqlite_PackedImage *packed, int format, int64 pgno, unsigned char *page);
+
+void
+sqlite_store_set_packed(sqlite_PageStore *store, int format, const unsigned char *data, Size size);
 
+/* Dump a database as SQL, passing xCallback one statement at a time,
+   see sqlite3_db_dump.c */
 int sqlite3_db_dump(
 	sqlite3 *db,
 	const char *zSchema,
 	const char *zTable,
-	int (*xCallback)(const char*,void*),
+	int (*xCallback)(const char*,int,void*),
 	void *pArg
 	);
 
+/* Prepare a statement for the first SQL statement in query, reusing a
+   cached one if possible.  *tail is set to the rest of query.  Returns
+   NULL if query holds no statement.  Every non-NULL result must be
+   handed back with sqlite_release_stmt(). */
+sqlite3_stmt *
+sqlite_prepare_cached(sqlite_Sqlite *sqlite, const char *query, const char **tail);
+
+/* Like sqlite_prepare_cached(), but if failed is given a query that
+   can't be prepared, or may not run on a read-only database, sets it
+   and returns NULL instead of raising an error. */
+sqlite3_stmt *
+sqlite_prepare_cached_ext(sqlite_Sqlite *sqlite, const char *query, const char **tail,
+						  bool *failed);
+
+/* Reset a statement and return it to the cache, or finalize it if it
+   was not cached. */
+void
+sqlite_release_stmt(sqlite_Sqlite *sqlite, sqlite3_stmt *stmt);
+
+/* Finalize all cached statements. */
+void
+sqlite_stmt_cache_clear(sqlite_Sqlite *sqlite);
+
+/* Reset all statements after an error, finalizing uncached ones. */
+void
+sqlite_stmt_cache_reset(sqlite_Sqlite *sqlite);
+
+/* Release the statements in use by an aborted subtransaction. */
+void
+sqlite_stmt_cache_abort_sub(sqlite_Sqlite *sqlite, SubTransactionId subxid);
+
+/* Hand the statements of a committed subtransaction to its parent. */
+void
+sqlite_stmt_cache_commit_sub(sqlite_Sqlite *sqlite, SubTransactionId subxid,
+							 SubTransactionId parent);
+
+/* SQLite authorizer of read-only databases, which denies statements of
+   the caller anything but reading. */
+int
+sqlite_readonly_authorizer(void *arg, int action, const char *arg1, const char *arg2,
+						   const char *dbname, const char *trigger);
+
+/* Memory cap in kB of the backend database cache (sqlite.cache_size) */
+extern int sqlite_cache_size;
+
+/* Look up an out of line sqlite datum in the backend database cache. */
+sqlite_Sqlite *
+sqlite_cache_lookup(Datum d, bool insert);
+
+/* Converts one SQLite result column to a declared Postgres type, see
+   sqlite_convert.c */
+typedef struct sqlite_Converter sqlite_Converter;
+
+typedef Datum (*sqlite_ConvertFunc) (sqlite3_stmt *stmt, int col, int type,
+									 sqlite_Converter *conv);
+
+struct sqlite_Converter {
+	sqlite_ConvertFunc convert;
+	Oid typid;
+	int32 typmod;
+	/* Input function, for values converted from their text form */
+	FmgrInfo input;
+	Oid ioparam;
+};
+
+/* Choose converters for the columns of tupdesc, checking that stmt
+   returns as many columns, if given. */
+sqlite_Converter *
+sqlite_get_converters(sqlite3_stmt *stmt, TupleDesc tupdesc);
+
+/* Convert the current result row of stmt. */
+void
+sqlite_convert_row(sqlite3_stmt *stmt, sqlite_Converter *converters, int natts,
+				   Datum *values, bool *nulls);
+
+/* Values to bind to statement parameters, see sqlite_bind.c.  Values
+   shared by several statements may be more than one of them uses,
+   nused is the most any of them did. */
+typedef struct sqlite_BindArgs {
+	int nargs;
+	Datum *values;
+	bool *nulls;
+	Oid *types;
+	bool shared;
+	int nused;
+} sqlite_BindArgs;
+
+/* Collect the variadic arguments of a function from first on. */
+void
+sqlite_get_bind_args(FunctionCallInfo fcinfo, int first, sqlite_BindArgs *args);
+
+/* Bind args to the parameters of stmt. */
+void
+sqlite_bind_args(sqlite_Sqlite *sqlite, sqlite3_stmt *stmt, sqlite_BindArgs *args);
+
+/* Bind a single value of type typid to parameter param of stmt. */
+void
+sqlite_bind_value(sqlite_Sqlite *sqlite, sqlite3_stmt *stmt, int param,
+				  Datum value, bool isnull, Oid typid);
+
+/* Text output formats (sqlite.output_format) */
+#define SQLITE_OUTPUT_SQL 0
+#define SQLITE_OUTPUT_IMAGE 1
+
+extern int sqlite_output_format;
+
+/* Return the database file image of sqlite, see sqlite_serialize.c */
+bytea *
+sqlite_serialize_image(sqlite_Sqlite *sqlite);
+
+/* Make a new database from a copy of a database file image, raising an
+   error if it isn't a well formed database, see sqlite_deserialize.c */
+sqlite_Sqlite *
+sqlite_deserialize_image(const char *data, Size size);
+
+/* Shared statistics, see sqlite_stats.c */
+typedef enum sqlite_StatKind {
+	SQLITE_STAT_EXPAND,
+	SQLITE_STAT_DESERIALIZE,
+	SQLITE_STAT_FLATTEN,
+	SQLITE_STAT_DUMP,
+	SQLITE_STAT_PREPARE,
+	SQLITE_STAT_STEP,
+	SQLITE_STAT_NUM_KINDS
+} sqlite_StatKind;
+
+extern bool sqlite_track_timing;
+
+void
+sqlite_stats_init(void);
+
+/* Note when an event begins, reading the clock only when timing is
+   tracked. */
+#define SQLITE_STATS_START(start)				\
+	do {										\
+		if (sqlite_track_timing)				\
+			INSTR_TIME_SET_CURRENT(start);		\
+		else									\
+			INSTR_TIME_SET_ZERO(start);			\
+	} while (0)
+
+/* Count an event of kind that handled bytes and began at start. */
+void
+sqlite_stats_add(sqlite_StatKind kind, uint64 bytes, instr_time start);
+
+/* sqlite3_step(), counted in the statistics. */
+int
+sqlite_step(sqlite3_stmt *stmt);
+
+/* Planner estimates for sqlite_query(), see sqlite_support.c */
+extern int sqlite_query_rows;
+extern double sqlite_query_cost;
+
+/* Pushdown of quals, ORDER BY and LIMIT into sqlite_query(), see
+   sqlite_pushdown.c */
+extern bool sqlite_enable_pushdown;
+
+void
+sqlite_pushdown_init(void);
+
+extern PGDLLEXPORT Datum sqlite_query(PG_FUNCTION_ARGS);
+
 /* Helper function that either detoasts or expands. */
 sqlite_Sqlite *DatumGetSqlite(Datum d);
 
+/* Same, for callers that never modify the database. */
+sqlite_Sqlite *DatumGetSqliteReadOnly(Datum d);
+
+/* Make a private writable copy of a read-only database. */
+sqlite_Sqlite *sqlite_copy_writable(sqlite_Sqlite *ro);
+
 /* Helper macro to detoast and expand sqlites arguments */
 #define SQLITE_GETARG(n)  DatumGetSqlite(PG_GETARG_DATUM(n))
 
+/* Helper macro to map sqlite arguments that are only read */
+#define SQLITE_GETARG_RO(n)  DatumGetSqliteReadOnly(PG_GETARG_DATUM(n))
+
 /* Helper macro to return Expanded Object Header Pointer from sqlite. */
 #define SQLITE_RETURN(A) return EOHPGetRWDatum(&(A)->hdr)
 
@@ -66,7 +431,7 @@ sqlite_Sqlite *DatumGetSqlite(Datum d);
 #define SQLITE_DATA(a) (((unsigned char *) (a)) + SQLITE_OVERHEAD())
 
 /* Help macro to cast generic Datum header pointer to expanded Sqlite */
-#define SqliteGetEOHP(d) (sqlite_Sqlite *) DatumGetEOHP(d);
+#define SqliteGetEOHP(d) ((sqlite_Sqlite *) DatumGetEOHP(d))
 
 /* Public API functions */
 
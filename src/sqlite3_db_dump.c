@@ -20,7 +20,7 @@
 **          sqlite3 *db,
 **          const char *zSchema,
 **          const char *zTable,
-**          void (*xCallback)(void*, const char*),
+**          int (*xCallback)(const char*, int, void*),
 **          void *pArg
 **   );
 **
@@ -30,10 +30,11 @@
 ** only the content of that one table is dumped.  If zTable is NULL, then all
 ** tables are dumped.
 **
-** The generate text is passed to xCallback() in multiple calls.  The second
-** argument to xCallback() is a copy of the pArg parameter.  The first
-** argument is some of the output text that this routine generates.  The
-** signature to xCallback() is designed to make it compatible with fputs().
+** The generated text is passed to xCallback() one SQL statement per call,
+** including its terminating ";\n".  The first argument is the statement,
+** the second its length in bytes and the third a copy of the pArg
+** parameter.  Each statement is built in a single buffer that is reused
+** for the next one, so the callback must copy out what it keeps.
 **
 ** The sqlite3_db_dump() subroutine returns SQLITE_OK on success or some error
 ** code if it encounters a problem.
@@ -50,6 +51,16 @@
 #include <string.h>
 #include <ctype.h>
 
+/*
+** A variable length string to which one can append text.
+*/
+typedef struct DText DText;
+struct DText {
+  char *z;           /* The text */
+  int n;             /* Number of bytes of content in z[] */
+  int nAlloc;        /* Number of bytes allocated to z[] */
+};
+
 /*
 ** The state of the dump process.
 */
@@ -59,18 +70,9 @@ struct DState {
   int nErr;                   /* Number of errors seen so far */
   int rc;                     /* Error code */
   int writableSchema;                    /* True if in writable_schema mode */
-  int (*xCallback)(const char*,void*);   /* Send output here */
+  int (*xCallback)(const char*,int,void*);  /* Send output here */
   void *pArg;                            /* Argument to xCallback() */
-};
-
-/*
-** A variable length string to which one can append text.
-*/
-typedef struct DText DText;
-struct DText {
-  char *z;           /* The text */
-  int n;             /* Number of bytes of content in z[] */
-  int nAlloc;        /* Number of bytes allocated to z[] */
+  DText out;                             /* Statement being output */
 };
 
 /*
@@ -278,7 +280,58 @@ col_oom:
 }
 
 /*
-** Send mprintf-formatted content to the output callback.
+** Make room for n more bytes and a terminator in the output buffer.
+** Return a pointer to the end of the output, or NULL if out of memory.
+*/
+static char *output_reserve(DState *p, sqlite3_int64 n){
+  DText *pOut = &p->out;
+  if( pOut->n+n+1>pOut->nAlloc ){
+    sqlite3_int64 nNew = (sqlite3_int64)pOut->nAlloc*2 + n + 1024;
+    char *zNew;
+    if( nNew>0x7fffffff ) nNew = pOut->n+n+1;
+    if( nNew>0x7fffffff ) zNew = 0;
+    else zNew = sqlite3_realloc(pOut->z, (int)nNew);
+    if( zNew==0 ){
+      p->nErr++;
+      p->rc = SQLITE_NOMEM;
+      return 0;
+    }
+    pOut->z = zNew;
+    pOut->nAlloc = (int)nNew;
+  }
+  return pOut->z + pOut->n;
+}
+
+/*
+** Append n bytes of z to the output.
+*/
+static void output_bytes(DState *p, const char *z, sqlite3_int64 n){
+  char *zOut;
+  if( n<=0 || (zOut = output_reserve(p, n))==0 ) return;
+  memcpy(zOut, z, n);
+  p->out.n += (int)n;
+  p->out.z[p->out.n] = '\0';
+}
+
+/*
+** Append a string to the output.
+*/
+static void output_text(DState *p, const char *z){
+  output_bytes(p, z, strlen(z));
+}
+
+/*
+** Send the statement in the output buffer to the callback and empty
+** the buffer for the next one.
+*/
+static void output_flush(DState *p){
+  if( p->out.n==0 ) return;
+  p->xCallback(p->out.z, p->out.n, p->pArg);
+  p->out.n = 0;
+}
+
+/*
+** Append mprintf-formatted content to the output.
 */
 static void output_formatted(DState *p, const char *zFormat, ...){
   va_list ap;
@@ -286,7 +339,12 @@ static void output_formatted(DState *p, const char *zFormat, ...){
   va_start(ap, zFormat);
   z = sqlite3_vmprintf(zFormat, ap);
   va_end(ap);
-  p->xCallback(z, p->pArg);
+  if( z==0 ){
+    p->nErr++;
+    p->rc = SQLITE_NOMEM;
+    return;
+  }
+  output_text(p, z);
   sqlite3_free(z);
 }
 
@@ -316,41 +374,46 @@ static const char *unused_string(
 ** Additionallly , escape the "\n" and "\r" characters so that they do not
 ** get corrupted by end-of-line translation facilities in some operating
 ** systems.
+**
+** The string is scanned for the characters needing attention with
+** strcspn() and memchr(), which the C library vectorizes, and copied to
+** the output in runs between them.
 */
 static void output_quoted_escaped_string(DState *p, const char *z){
-  int i;
+  size_t i = strcspn(z, "'\n\r");
   char c;
-  for(i=0; (c = z[i])!=0 && c!='\'' && c!='\n' && c!='\r'; i++){}
-  if( c==0 ){
-    output_formatted(p,"'%s'",z);
+  if( z[i]==0 ){
+    char *zOut = output_reserve(p, (sqlite3_int64)i+2);
+    if( zOut==0 ) return;
+    zOut[0] = '\'';
+    memcpy(zOut+1, z, i);
+    zOut[i+1] = '\'';
+    zOut[i+2] = '\0';
+    p->out.n += (int)i+2;
   }else{
+    size_t n = i + strlen(z+i);
     const char *zNL = 0;
     const char *zCR = 0;
-    int nNL = 0;
-    int nCR = 0;
+    int nNL = memchr(z+i, '\n', n-i)!=0;
+    int nCR = memchr(z+i, '\r', n-i)!=0;
     char zBuf1[20], zBuf2[20];
-    for(i=0; z[i]; i++){
-      if( z[i]=='\n' ) nNL++;
-      if( z[i]=='\r' ) nCR++;
-    }
     if( nNL ){
-      p->xCallback("replace(", p->pArg);
+      output_text(p, "replace(");
       zNL = unused_string(z, "\\n", "\\012", zBuf1);
     }
     if( nCR ){
-      p->xCallback("replace(", p->pArg);
+      output_text(p, "replace(");
       zCR = unused_string(z, "\\r", "\\015", zBuf2);
     }
-    p->xCallback("'", p->pArg);
+    output_bytes(p, "'", 1);
     while( *z ){
-      for(i=0; (c = z[i])!=0 && c!='\n' && c!='\r' && c!='\''; i++){}
+      i = strcspn(z, "'\n\r");
+      c = z[i];
       if( c=='\'' ) i++;
-      if( i ){
-        output_formatted(p, "%.*s", i, z);
-        z += i;
-      }
+      output_bytes(p, z, i);
+      z += i;
       if( c=='\'' ){
-        p->xCallback("'", p->pArg);
+        output_bytes(p, "'", 1);
         continue;
       }
       if( c==0 ){
@@ -358,12 +421,12 @@ static void output_quoted_escaped_string(DState *p, const char *z){
       }
       z++;
       if( c=='\n' ){
-        p->xCallback(zNL, p->pArg);
+        output_text(p, zNL);
         continue;
       }
-      p->xCallback(zCR, p->pArg);
+      output_text(p, zCR);
     }
-    p->xCallback("'", p->pArg);
+    output_bytes(p, "'", 1);
     if( nCR ){
       output_formatted(p, ",'%s',char(13))", zCR);
     }
@@ -373,6 +436,25 @@ static void output_quoted_escaped_string(DState *p, const char *z){
   }
 }
 
+/*
+** Output a blob as a hex literal, written straight into the output.
+*/
+static void output_hex_blob(DState *p, const unsigned char *a, int nByte){
+  static const char zHex[] = "0123456789abcdef";
+  char *zOut = output_reserve(p, (sqlite3_int64)nByte*2+3);
+  int j;
+  if( zOut==0 ) return;
+  *zOut++ = 'x';
+  *zOut++ = '\'';
+  for(j=0; j<nByte; j++){
+    *zOut++ = zHex[(a[j]>>4)&15];
+    *zOut++ = zHex[a[j]&15];
+  }
+  *zOut++ = '\'';
+  *zOut = '\0';
+  p->out.n += nByte*2+3;
+}
+
 /*
 ** This is an sqlite3_exec callback routine used for dumping the database.
 ** Each row received by this callback consists of a table name,
@@ -394,29 +476,34 @@ static int dump_callback(void *pArg, int nArg, char **azArg, char **azCol){
   zSql = azArg[2];
 
   if( strcmp(zTable, "sqlite_sequence")==0 ){
-    p->xCallback("DELETE FROM sqlite_sequence;\n", p->pArg);
+    output_text(p, "DELETE FROM sqlite_sequence;\n");
+    output_flush(p);
   }else if( sqlite3_strglob("sqlite_stat?", zTable)==0 ){
-    p->xCallback("ANALYZE sqlite_schema;\n", p->pArg);
+    output_text(p, "ANALYZE sqlite_schema;\n");
+    output_flush(p);
   }else if( strncmp(zTable, "sqlite_", 7)==0 ){
     return 0;
   }else if( strncmp(zSql, "CREATE VIRTUAL TABLE", 20)==0 ){
     if( !p->writableSchema ){
-      p->xCallback("PRAGMA writable_schema=ON;\n", p->pArg);
+      output_text(p, "PRAGMA writable_schema=ON;\n");
+      output_flush(p);
       p->writableSchema = 1;
     }
     output_formatted(p,
        "INSERT INTO sqlite_schema(type,name,tbl_name,rootpage,sql)"
        "VALUES('table','%q','%q',0,'%q');",
        zTable, zTable, zSql);
+    output_flush(p);
     return 0;
   }else{
     if( sqlite3_strglob("CREATE TABLE ['\"]*", zSql)==0 ){
-      p->xCallback("CREATE TABLE IF NOT EXISTS ", p->pArg);
-      p->xCallback(zSql+13, p->pArg);
+      output_text(p, "CREATE TABLE IF NOT EXISTS ");
+      output_text(p, zSql+13);
     }else{
-      p->xCallback(zSql, p->pArg);
+      output_text(p, zSql);
     }
-    p->xCallback(";\n", p->pArg);
+    output_text(p, ";\n");
+    output_flush(p);
   }
 
   if( strcmp(zType, "table")==0 ){
@@ -476,12 +563,15 @@ static int dump_callback(void *pArg, int nArg, char **azArg, char **azCol){
       if( p->rc==SQLITE_OK ) p->rc = rc;
     }else{
       while( SQLITE_ROW==sqlite3_step(pStmt) ){
-        p->xCallback(sTable.z, p->pArg);
+        output_bytes(p, sTable.z, sTable.n);
         for(i=0; i<nCol; i++){
-          if( i ) p->xCallback(",", p->pArg);
+          char zBuf[50];
+          if( i ) output_bytes(p, ",", 1);
           switch( sqlite3_column_type(pStmt,i) ){
             case SQLITE_INTEGER: {
-              output_formatted(p, "%lld", sqlite3_column_int64(pStmt,i));
+              sqlite3_snprintf(sizeof(zBuf), zBuf, "%lld",
+                               sqlite3_column_int64(pStmt,i));
+              output_text(p, zBuf);
               break;
             }
             case SQLITE_FLOAT: {
@@ -489,16 +579,17 @@ static int dump_callback(void *pArg, int nArg, char **azArg, char **azCol){
               sqlite3_uint64 ur;
               memcpy(&ur,&r,sizeof(r));
               if( ur==0x7ff0000000000000LL ){
-                p->xCallback("1e999", p->pArg);
+                output_text(p, "1e999");
               }else if( ur==0xfff0000000000000LL ){
-                p->xCallback("-1e999", p->pArg);
+                output_text(p, "-1e999");
               }else{
-                output_formatted(p, "%!.20g", r);
+                sqlite3_snprintf(sizeof(zBuf), zBuf, "%!.20g", r);
+                output_text(p, zBuf);
               }
               break;
             }
             case SQLITE_NULL: {
-              p->xCallback("NULL", p->pArg);
+              output_text(p, "NULL");
               break;
             }
             case SQLITE_TEXT: {
@@ -507,23 +598,15 @@ static int dump_callback(void *pArg, int nArg, char **azArg, char **azCol){
               break;
             }
             case SQLITE_BLOB: {
-              int nByte = sqlite3_column_bytes(pStmt,i);
-              unsigned char *a = (unsigned char*)sqlite3_column_blob(pStmt,i);
-              int j;
-              p->xCallback("x'", p->pArg);
-              for(j=0; j<nByte; j++){
-                char zWord[3];
-                zWord[0] = "0123456789abcdef"[(a[j]>>4)&15];
-                zWord[1] = "0123456789abcdef"[a[j]&15];
-                zWord[2] = 0;
-                p->xCallback(zWord, p->pArg);
-              }
-              p->xCallback("'", p->pArg);
+              output_hex_blob(p,
+                   (const unsigned char*)sqlite3_column_blob(pStmt,i),
+                   sqlite3_column_bytes(pStmt,i));
               break;
             }
           }
         }
-        p->xCallback(");\n", p->pArg);
+        output_text(p, ");\n");
+        output_flush(p);
       }
     }
     sqlite3_finalize(pStmt);
@@ -569,6 +652,7 @@ static void output_sql_from_query(
   if( rc!=SQLITE_OK || !pSelect ){
     output_formatted(p, "/**** ERROR: (%d) %s *****/\n", rc,
                 sqlite3_errmsg(p->db));
+    output_flush(p);
     p->nErr++;
     return;
   }
@@ -576,24 +660,27 @@ static void output_sql_from_query(
   nResult = sqlite3_column_count(pSelect);
   while( rc==SQLITE_ROW ){
     z = (const char*)sqlite3_column_text(pSelect, 0);
-    p->xCallback(z, p->pArg);
+    if( z==0 ) z = "";
+    output_text(p, z);
     for(i=1; i<nResult; i++){
-      p->xCallback(",", p->pArg);
-      p->xCallback((const char*)sqlite3_column_text(pSelect,i), p->pArg);
+      const char *zCol = (const char*)sqlite3_column_text(pSelect,i);
+      output_bytes(p, ",", 1);
+      if( zCol ) output_text(p, zCol);
     }
-    if( z==0 ) z = "";
     while( z[0] && (z[0]!='-' || z[1]!='-') ) z++;
     if( z[0] ){
-      p->xCallback("\n;\n", p->pArg);
+      output_text(p, "\n;\n");
     }else{
-      p->xCallback(";\n", p->pArg);
+      output_text(p, ";\n");
     }
+    output_flush(p);
     rc = sqlite3_step(pSelect);
   }
   rc = sqlite3_finalize(pSelect);
   if( rc!=SQLITE_OK ){
     output_formatted(p, "/**** ERROR: (%d) %s *****/\n", rc,
                      sqlite3_errmsg(p->db));
+    output_flush(p);
     if( (rc&0xff)!=SQLITE_CORRUPT ) p->nErr++;
   }
 }
@@ -620,6 +707,7 @@ static void run_schema_dump_query(
   sqlite3_free(z);
   if( zErr ){
     output_formatted(p, "/****** %s ******/\n", zErr);
+    output_flush(p);
     sqlite3_free(zErr);
     p->nErr++;
     zErr = 0;
@@ -634,7 +722,7 @@ int sqlite3_db_dump(
   sqlite3 *db,               /* The database connection */
   const char *zSchema,       /* Which schema to dump.  Usually "main". */
   const char *zTable,        /* Which table to dump.  NULL means everything. */
-  int (*xCallback)(const char*,void*),   /* Output sent to this callback */
+  int (*xCallback)(const char*,int,void*),  /* Output sent to this callback */
   void *pArg                             /* Second argument of the callback */
 ){
   DState x;
@@ -644,7 +732,10 @@ int sqlite3_db_dump(
   x.db = db;
   x.xCallback = xCallback;
   x.pArg = pArg;
-  xCallback("PRAGMA foreign_keys=OFF;\nBEGIN TRANSACTION;\n", pArg);
+  output_text(&x, "PRAGMA foreign_keys=OFF;\n");
+  output_flush(&x);
+  output_text(&x, "BEGIN TRANSACTION;\n");
+  output_flush(&x);
   if( zTable==0 ){
     run_schema_dump_query(&x,
       "SELECT name, type, sql FROM \"%w\".sqlite_schema "
@@ -675,9 +766,12 @@ int sqlite3_db_dump(
     );
   }
   if( x.writableSchema ){
-    xCallback("PRAGMA writable_schema=OFF;\n", pArg);
+    output_text(&x, "PRAGMA writable_schema=OFF;\n");
+    output_flush(&x);
   }
-  xCallback(x.nErr ? "ROLLBACK; -- due to errors\n" : "COMMIT;\n", pArg);
+  output_text(&x, x.nErr ? "ROLLBACK; -- due to errors\n" : "COMMIT;\n");
+  output_flush(&x);
+  freeText(&x.out);
   sqlite3_exec(db, "COMMIT", 0, 0, 0);
   return x.rc;
 }
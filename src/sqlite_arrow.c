@@ -0,0 +1,643 @@
+#include "sqlite.h"
+
+#include "miscadmin.h"
+
+PG_FUNCTION_INFO_V1(sqlite_to_arrow);
+
+/* Query results as an Arrow IPC stream.
+
+   The stream is a Schema message followed by a RecordBatch message for
+   every batch_size rows and the end of stream marker, as read by
+   pyarrow.ipc.open_stream() and the other Arrow libraries.  Each column
+   is written as a nullable Int64, Float64, Utf8 or Binary array,
+   collected into buffers of its own straight from the values of the
+   statement while it is stepped.
+
+   SQLite values have no fixed type, so the type of a column is chosen
+   from its declared type when it has an INTEGER, REAL or TEXT affinity,
+   and otherwise from the values of the first batch: integers make an
+   Int64 column, integers and reals a Float64 column, any blob a Binary
+   column and anything else Utf8.  Rows of the first batch are held
+   until the schema is written.  A later value that doesn't fit the type
+   of its column, like a real in an Int64 column, is an error, a CAST in
+   the query settles the type of a column for good.
+
+   The Arrow metadata are FlatBuffers, written here directly rather than
+   through a library.  Tables are laid out front to back, each after its
+   vtable, and the offsets to the objects they refer to are patched in
+   as those are written after them.  FlatBuffers are little-endian, the
+   array buffers are in the byte order of the server, which the schema
+   says.
+*/
+
+/* From the Arrow format, Schema.fbs and Message.fbs */
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_BINARY 4
+#define ARROW_TYPE_UTF8 5
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_CONTINUATION 0xFFFFFFFF
+
+#ifdef WORDS_BIGENDIAN
+#define ARROW_ENDIANNESS 1
+#else
+#define ARROW_ENDIANNESS 0
+#endif
+
+static const char *const sqlite_arrow_type_names[] = {
+	NULL, NULL, "int64", "float64", "binary", "utf8"
+};
+
+static const char *const sqlite_arrow_storage_class_names[] = {
+	NULL, "INTEGER", "REAL", "TEXT", "BLOB", "NULL"
+};
+
+typedef struct sqlite_ArrowColumn {
+	char *name;
+	/* ARROW_TYPE_*, 0 until known */
+	int type;
+	StringInfoData validity;
+	StringInfoData offsets;
+	StringInfoData data;
+	int64 null_count;
+} sqlite_ArrowColumn;
+
+/* Append value to fb as a little-endian integer of size bytes */
+static void
+fb_append(StringInfo fb, uint64 value, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		appendStringInfoChar(fb, (char) ((value >> (8 * i)) & 0xff));
+}
+
+/* Set the little-endian integer of size bytes at pos */
+static void
+fb_set(StringInfo fb, int pos, uint64 value, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		fb->data[pos + i] = (char) ((value >> (8 * i)) & 0xff);
+}
+
+/* Point the offset at pos to the object at target */
+static void
+fb_link(StringInfo fb, int pos, int target)
+{
+	fb_set(fb, pos, (uint32) (target - pos), 4);
+}
+
+static void
+fb_pad(StringInfo fb, int align)
+{
+	while (fb->len % align != 0)
+		appendStringInfoChar(fb, '\0');
+}
+
+/* Write a table with fields of the given sizes, 0 for an absent field,
+   and its vtable.  Returns the position of the table and sets pos[i] to
+   the position of each field present.  Fields are laid out largest
+   first after the vtable offset, which is placed 4 bytes before an 8
+   byte boundary, so that each is aligned to its size. */
+static int
+fb_table(StringInfo fb, int nfields, const int *sizes, int *pos)
+{
+	int vtable;
+	int table;
+	int offset = 4;
+	int size;
+	int i;
+
+	for (i = 0; i < nfields; i++)
+		pos[i] = 0;
+	for (size = 8; size >= 1; size /= 2)
+	{
+		for (i = 0; i < nfields; i++)
+		{
+			if (sizes[i] == size)
+			{
+				pos[i] = offset;
+				offset += size;
+			}
+		}
+	}
+
+	fb_pad(fb, 2);
+	vtable = fb->len;
+	fb_append(fb, 4 + 2 * nfields, 2);
+	fb_append(fb, offset, 2);
+	for (i = 0; i < nfields; i++)
+		fb_append(fb, sizes[i] ? pos[i] : 0, 2);
+
+	while (fb->len % 8 != 4)
+		appendStringInfoChar(fb, '\0');
+	table = fb->len;
+	fb_append(fb, table - vtable, 4);
+	for (i = 4; i < offset; i++)
+		appendStringInfoChar(fb, '\0');
+
+	for (i = 0; i < nfields; i++)
+		if (sizes[i])
+			pos[i] += table;
+	return table;
+}
+
+/* Start a vector of n elements of size bytes, returns its position */
+static int
+fb_vector(StringInfo fb, int n, int size)
+{
+	int vector;
+
+	while ((fb->len + 4) % Max(size, 4) != 0)
+		appendStringInfoChar(fb, '\0');
+	vector = fb->len;
+	fb_append(fb, n, 4);
+	return vector;
+}
+
+static int
+fb_string(StringInfo fb, const char *str)
+{
+	int len = strlen(str);
+	int string;
+
+	fb_pad(fb, 4);
+	string = fb->len;
+	fb_append(fb, len, 4);
+	appendBinaryStringInfo(fb, str, len);
+	appendStringInfoChar(fb, '\0');
+	return string;
+}
+
+/* Start the Message flatbuffer of a message.  Returns the position of
+   its header offset and sets body to the position of its body length. */
+static int
+arrow_message_start(StringInfo fb, int header_type, int *body)
+{
+	static const int sizes[] = {2, 1, 4, 8};	/* version, header_type, header, bodyLength */
+	int pos[4];
+
+	/* The root offset */
+	fb_append(fb, 0, 4);
+	fb_link(fb, 0, fb_table(fb, 4, sizes, pos));
+	fb_set(fb, pos[0], ARROW_METADATA_V5, 2);
+	fb_set(fb, pos[1], header_type, 1);
+	*body = pos[3];
+	return pos[2];
+}
+
+/* Append a message with fb as its metadata to out, the body follows */
+static void
+arrow_message_end(StringInfo out, StringInfo fb)
+{
+	/* Keeps the body 8 byte aligned */
+	fb_pad(fb, 8);
+	fb_append(out, ARROW_CONTINUATION, 4);
+	fb_append(out, fb->len, 4);
+	appendBinaryStringInfo(out, fb->data, fb->len);
+	pfree(fb->data);
+}
+
+/* Append a buffer of a message body, padded to 8 bytes */
+static void
+arrow_append_buffer(StringInfo out, const char *data, int len)
+{
+	appendBinaryStringInfo(out, data, len);
+	for (; len % 8 != 0; len++)
+		appendStringInfoChar(out, '\0');
+}
+
+static int
+arrow_type_table(StringInfo fb, int type)
+{
+	int sizes[2];
+	int pos[2];
+	int table;
+
+	switch (type)
+	{
+		case ARROW_TYPE_INT:
+			/* bitWidth, is_signed */
+			sizes[0] = 4;
+			sizes[1] = 1;
+			table = fb_table(fb, 2, sizes, pos);
+			fb_set(fb, pos[0], 64, 4);
+			fb_set(fb, pos[1], 1, 1);
+			break;
+		case ARROW_TYPE_FLOATING_POINT:
+			/* precision */
+			sizes[0] = 2;
+			table = fb_table(fb, 1, sizes, pos);
+			fb_set(fb, pos[0], ARROW_PRECISION_DOUBLE, 2);
+			break;
+		default:
+			table = fb_table(fb, 0, sizes, pos);
+			break;
+	}
+	return table;
+}
+
+static void
+arrow_write_schema(StringInfo out, sqlite_ArrowColumn *columns, int ncols)
+{
+	static const int schema_sizes[] = {2, 4};	/* endianness, fields */
+	/* name, nullable, type_type, type, dictionary, children */
+	static const int field_sizes[] = {4, 1, 1, 4, 0, 4};
+	StringInfoData fb;
+	int schema[2];
+	int field[6];
+	int header;
+	int body;
+	int fields;
+	int i;
+
+	initStringInfo(&fb);
+	header = arrow_message_start(&fb, ARROW_HEADER_SCHEMA, &body);
+
+	fb_link(&fb, header, fb_table(&fb, 2, schema_sizes, schema));
+	fb_set(&fb, schema[0], ARROW_ENDIANNESS, 2);
+	fb_link(&fb, schema[1], fb_vector(&fb, ncols, 4));
+	fields = fb.len;
+	for (i = 0; i < ncols; i++)
+		fb_append(&fb, 0, 4);
+
+	for (i = 0; i < ncols; i++)
+	{
+		fb_link(&fb, fields + 4 * i, fb_table(&fb, 6, field_sizes, field));
+		fb_set(&fb, field[1], 1, 1);
+		fb_set(&fb, field[2], columns[i].type, 1);
+		fb_link(&fb, field[0], fb_string(&fb, columns[i].name));
+		fb_link(&fb, field[3], arrow_type_table(&fb, columns[i].type));
+		fb_link(&fb, field[5], fb_vector(&fb, 0, 4));
+	}
+
+	arrow_message_end(out, &fb);
+}
+
+#define ARROW_VARIABLE(column) \
+	((column)->type == ARROW_TYPE_UTF8 || (column)->type == ARROW_TYPE_BINARY)
+
+/* Write the nrows rows collected in columns as a record batch */
+static void
+arrow_write_batch(StringInfo out, sqlite_ArrowColumn *columns, int ncols, int64 nrows)
+{
+	static const int batch_sizes[] = {8, 4, 4};	/* length, nodes, buffers */
+	StringInfoData fb;
+	int batch[3];
+	int header;
+	int body;
+	int nbuffers = 0;
+	int64 offset = 0;
+	int i;
+
+	for (i = 0; i < ncols; i++)
+		nbuffers += ARROW_VARIABLE(&columns[i]) ? 3 : 2;
+
+	initStringInfo(&fb);
+	header = arrow_message_start(&fb, ARROW_HEADER_RECORD_BATCH, &body);
+
+	fb_link(&fb, header, fb_table(&fb, 3, batch_sizes, batch));
+	fb_set(&fb, batch[0], nrows, 8);
+
+	fb_link(&fb, batch[1], fb_vector(&fb, ncols, 16));
+	for (i = 0; i < ncols; i++)
+	{
+		fb_append(&fb, nrows, 8);
+		fb_append(&fb, columns[i].null_count, 8);
+	}
+
+	/* Validity, offsets of variable length columns, and data.  The
+	   validity bitmap is left out of a column without nulls. */
+	fb_link(&fb, batch[2], fb_vector(&fb, nbuffers, 16));
+	for (i = 0; i < ncols; i++)
+	{
+		sqlite_ArrowColumn *column = &columns[i];
+		int64 lengths[3];
+		int n = 0;
+		int j;
+
+		lengths[n++] = column->null_count > 0 ? column->validity.len : 0;
+		if (ARROW_VARIABLE(column))
+			lengths[n++] = column->offsets.len;
+		lengths[n++] = column->data.len;
+
+		for (j = 0; j < n; j++)
+		{
+			fb_append(&fb, offset, 8);
+			fb_append(&fb, lengths[j], 8);
+			offset += TYPEALIGN(8, lengths[j]);
+		}
+	}
+	fb_set(&fb, body, offset, 8);
+	arrow_message_end(out, &fb);
+
+	for (i = 0; i < ncols; i++)
+	{
+		sqlite_ArrowColumn *column = &columns[i];
+
+		if (column->null_count > 0)
+			arrow_append_buffer(out, column->validity.data, column->validity.len);
+		if (ARROW_VARIABLE(column))
+			arrow_append_buffer(out, column->offsets.data, column->offsets.len);
+		arrow_append_buffer(out, column->data.data, column->data.len);
+	}
+}
+
+/* Empty the buffers of a column for the next batch */
+static void
+arrow_column_reset(sqlite_ArrowColumn *column)
+{
+	int32 first = 0;
+
+	resetStringInfo(&column->validity);
+	resetStringInfo(&column->offsets);
+	resetStringInfo(&column->data);
+	column->null_count = 0;
+	if (ARROW_VARIABLE(column))
+		appendBinaryStringInfo(&column->offsets, (char *) &first, sizeof(int32));
+}
+
+/* Append the value of row, numbered within the batch, to a column: the
+   value of column col of the row stmt is on, or a held value when stmt
+   is NULL.  Values of a row being stepped are unprotected, only the
+   sqlite3_column_*() interfaces may read them. */
+static void
+arrow_column_append(sqlite_ArrowColumn *column, sqlite3_stmt *stmt, int col,
+					sqlite3_value *value, int64 row)
+{
+	int type = stmt ? sqlite3_column_type(stmt, col) : sqlite3_value_type(value);
+	const void *data;
+	int64 i;
+	double d;
+	int32 end;
+
+	if (row % 8 == 0)
+		appendStringInfoChar(&column->validity, '\0');
+
+	if (type != SQLITE_NULL)
+	{
+		column->validity.data[column->validity.len - 1] |= 1 << (row % 8);
+
+		switch (column->type)
+		{
+			case ARROW_TYPE_INT:
+				if (type != SQLITE_INTEGER)
+					break;
+				i = stmt ? sqlite3_column_int64(stmt, col) : sqlite3_value_int64(value);
+				appendBinaryStringInfo(&column->data, (char *) &i, sizeof(int64));
+				return;
+			case ARROW_TYPE_FLOATING_POINT:
+				if (type != SQLITE_INTEGER && type != SQLITE_FLOAT)
+					break;
+				d = stmt ? sqlite3_column_double(stmt, col) : sqlite3_value_double(value);
+				appendBinaryStringInfo(&column->data, (char *) &d, sizeof(double));
+				return;
+			case ARROW_TYPE_UTF8:
+				/* Numbers are written as SQLite prints them */
+				if (type == SQLITE_BLOB)
+					break;
+				data = stmt ? sqlite3_column_text(stmt, col) : sqlite3_value_text(value);
+				appendBinaryStringInfo(&column->data, (const char *) data,
+									   stmt ? sqlite3_column_bytes(stmt, col) : sqlite3_value_bytes(value));
+				end = column->data.len;
+				appendBinaryStringInfo(&column->offsets, (char *) &end, sizeof(int32));
+				return;
+			case ARROW_TYPE_BINARY:
+				data = stmt ? sqlite3_column_blob(stmt, col) : sqlite3_value_blob(value);
+				appendBinaryStringInfo(&column->data, (const char *) data,
+									   stmt ? sqlite3_column_bytes(stmt, col) : sqlite3_value_bytes(value));
+				end = column->data.len;
+				appendBinaryStringInfo(&column->offsets, (char *) &end, sizeof(int32));
+				return;
+		}
+
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("cannot convert SQLite %s value in column \"%s\" to Arrow %s",
+						sqlite_arrow_storage_class_names[type], column->name,
+						sqlite_arrow_type_names[column->type]),
+				 errhint("Cast the column to one type in the query.")));
+	}
+
+	/* A null still takes its slot in the data */
+	column->null_count++;
+	if (ARROW_VARIABLE(column))
+	{
+		end = column->data.len;
+		appendBinaryStringInfo(&column->offsets, (char *) &end, sizeof(int32));
+	}
+	else
+		appendStringInfoSpaces(&column->data, sizeof(int64));
+}
+
+/* The Arrow type of a column declared as decltype, by the affinity
+   rules of SQLite, or 0 when its values decide */
+static int
+arrow_declared_type(const char *decltype)
+{
+	char *upper;
+	char *p;
+	int type = 0;
+
+	if (decltype == NULL)
+		return 0;
+
+	upper = pstrdup(decltype);
+	for (p = upper; *p; p++)
+		*p = pg_toupper((unsigned char) *p);
+	if (strstr(upper, "INT"))
+		type = ARROW_TYPE_INT;
+	else if (strstr(upper, "CHAR") || strstr(upper, "CLOB") || strstr(upper, "TEXT"))
+		type = ARROW_TYPE_UTF8;
+	else if (strstr(upper, "BLOB"))
+		type = ARROW_TYPE_BINARY;
+	else if (strstr(upper, "REAL") || strstr(upper, "FLOA") || strstr(upper, "DOUB"))
+		type = ARROW_TYPE_FLOATING_POINT;
+	pfree(upper);
+	return type;
+}
+
+/* The Arrow type of a column from its values in the rows held */
+static int
+arrow_inferred_type(sqlite3_value **held, int nheld, int ncols, int col)
+{
+	bool text = false;
+	bool real = false;
+	bool integer = false;
+	int i;
+
+	for (i = 0; i < nheld; i++)
+	{
+		switch (sqlite3_value_type(held[i * ncols + col]))
+		{
+			case SQLITE_BLOB:
+				return ARROW_TYPE_BINARY;
+			case SQLITE_TEXT:
+				text = true;
+				break;
+			case SQLITE_FLOAT:
+				real = true;
+				break;
+			case SQLITE_INTEGER:
+				integer = true;
+				break;
+		}
+	}
+
+	/* Nulls alone make a Utf8 column, which takes any value but blobs */
+	if (real && !text)
+		return ARROW_TYPE_FLOATING_POINT;
+	if (integer && !text)
+		return ARROW_TYPE_INT;
+	return ARROW_TYPE_UTF8;
+}
+
+Datum
+sqlite_to_arrow(PG_FUNCTION_ARGS)
+{
+	sqlite_Sqlite *sqlite;
+	sqlite3_stmt *stmt;
+	sqlite_ArrowColumn *columns = NULL;
+	sqlite3_value **volatile held = NULL;
+	volatile int nheld = 0;
+	StringInfoData out;
+	int32 batch_size;
+	int64 nrows = 0;
+	bool infer = false;
+	int ncols = 0;
+	int rc = SQLITE_DONE;
+	int i;
+	int j;
+
+	LOGF();
+
+	sqlite = SQLITE_GETARG_RO(0);
+	batch_size = PG_GETARG_INT32(2);
+	if (batch_size <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("batch_size must be greater than zero")));
+
+	/* The stream is built in place behind the header of the result */
+	initStringInfo(&out);
+	appendStringInfoSpaces(&out, VARHDRSZ);
+
+	stmt = sqlite_prepare_cached(sqlite, text_to_cstring(PG_GETARG_TEXT_PP(1)), NULL);
+	if (stmt != NULL)
+		ncols = sqlite3_column_count(stmt);
+
+	columns = palloc0(Max(ncols, 1) * sizeof(sqlite_ArrowColumn));
+	for (i = 0; i < ncols; i++)
+	{
+		columns[i].name = pstrdup(sqlite3_column_name(stmt, i));
+		columns[i].type = arrow_declared_type(sqlite3_column_decltype(stmt, i));
+		infer = infer || columns[i].type == 0;
+		initStringInfo(&columns[i].validity);
+		initStringInfo(&columns[i].offsets);
+		initStringInfo(&columns[i].data);
+	}
+
+	if (stmt == NULL)
+		arrow_write_schema(&out, columns, ncols);
+	else
+	{
+		PG_TRY();
+		{
+			/* Hold the rows of the first batch until the types of the
+			   columns are known */
+			if (infer)
+			{
+				int maxheld = Min(batch_size, 64);
+
+				held = palloc((Size) maxheld * ncols * sizeof(sqlite3_value *));
+				while (nheld < batch_size && (rc = sqlite_step(stmt)) == SQLITE_ROW)
+				{
+					CHECK_FOR_INTERRUPTS();
+
+					if (nheld == maxheld)
+					{
+						maxheld = Min(maxheld * 2, batch_size);
+						held = repalloc(held, (Size) maxheld * ncols * sizeof(sqlite3_value *));
+					}
+					for (i = 0; i < ncols; i++)
+					{
+						held[nheld * ncols + i] = sqlite3_value_dup(sqlite3_column_value(stmt, i));
+						if (held[nheld * ncols + i] == NULL)
+						{
+							/* Keep the values duplicated so far to free */
+							for (j = i + 1; j < ncols; j++)
+								held[nheld * ncols + j] = NULL;
+							nheld++;
+							ereport(ERROR,
+									(errcode(ERRCODE_OUT_OF_MEMORY),
+									 errmsg("out of memory")));
+						}
+					}
+					nheld++;
+				}
+
+				for (i = 0; i < ncols; i++)
+					if (columns[i].type == 0)
+						columns[i].type = arrow_inferred_type(held, nheld, ncols, i);
+			}
+
+			arrow_write_schema(&out, columns, ncols);
+			for (i = 0; i < ncols; i++)
+				arrow_column_reset(&columns[i]);
+
+			for (nrows = 0; nrows < nheld; nrows++)
+				for (i = 0; i < ncols; i++)
+					arrow_column_append(&columns[i], NULL, i, held[nrows * ncols + i], nrows);
+
+			/* Step on unless holding rows already ran the statement */
+			while ((!infer || nheld == batch_size) && (rc = sqlite_step(stmt)) == SQLITE_ROW)
+			{
+				CHECK_FOR_INTERRUPTS();
+
+				if (nrows == batch_size)
+				{
+					arrow_write_batch(&out, columns, ncols, nrows);
+					for (i = 0; i < ncols; i++)
+						arrow_column_reset(&columns[i]);
+					nrows = 0;
+				}
+				for (i = 0; i < ncols; i++)
+					arrow_column_append(&columns[i], stmt, i, NULL, nrows);
+				nrows++;
+			}
+
+			if (rc != SQLITE_DONE)
+			{
+				sqlite_store_check_error(&sqlite->store);
+				ereport(ERROR, (errmsg("Failed to execute SQLite query: %s", sqlite3_errmsg(sqlite->db))));
+			}
+
+			if (nrows > 0)
+				arrow_write_batch(&out, columns, ncols, nrows);
+		}
+		PG_FINALLY();
+		{
+			for (i = 0; i < nheld * ncols; i++)
+				sqlite3_value_free(held[i]);
+			sqlite_release_stmt(sqlite, stmt);
+		}
+		PG_END_TRY();
+	}
+
+	/* End of stream */
+	fb_append(&out, ARROW_CONTINUATION, 4);
+	fb_append(&out, 0, 4);
+
+	SET_VARSIZE(out.data, out.len);
+	PG_RETURN_BYTEA_P((bytea *) out.data);
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -0,0 +1,163 @@
+#include "sqlite.h"
+
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+
+/* Binding of Postgres values to SQLite statement parameters.
+
+   Values are bound by position, the first value to parameter 1 and so
+   on.  SQLite numbers named parameters like :name, @name and $name in
+   the order they first appear, a name used again is the same
+   parameter, and ?NNN is parameter NNN, so they all bind by position
+   too.  Every value must be bound to a parameter, a value too many is
+   more likely a mistake than meant.  Integers, floats, booleans,
+   text and bytea are bound natively, any other type as its text output.
+   SQLite copies every value it is given, so bound values need not
+   outlive the call.
+*/
+
+/* Collect the variadic arguments of fcinfo starting at first, either
+   passed one by one or as an array with VARIADIC. */
+void
+sqlite_get_bind_args(FunctionCallInfo fcinfo, int first, sqlite_BindArgs *args)
+{
+	int i;
+
+	args->nargs = 0;
+	args->shared = false;
+	args->nused = 0;
+	if (PG_NARGS() <= first)
+		return;
+
+	if (get_fn_expr_variadic(fcinfo->flinfo))
+	{
+		ArrayType *array;
+		Oid element_type;
+		int16 typlen;
+		bool typbyval;
+		char typalign;
+
+		if (PG_ARGISNULL(first))
+			return;
+
+		array = PG_GETARG_ARRAYTYPE_P(first);
+		element_type = ARR_ELEMTYPE(array);
+		get_typlenbyvalalign(element_type, &typlen, &typbyval, &typalign);
+		deconstruct_array(array, element_type, typlen, typbyval, typalign,
+						  &args->values, &args->nulls, &args->nargs);
+		args->types = palloc(args->nargs * sizeof(Oid));
+		for (i = 0; i < args->nargs; i++)
+			args->types[i] = element_type;
+		return;
+	}
+
+	args->nargs = PG_NARGS() - first;
+	args->values = palloc(args->nargs * sizeof(Datum));
+	args->nulls = palloc(args->nargs * sizeof(bool));
+	args->types = palloc(args->nargs * sizeof(Oid));
+	for (i = 0; i < args->nargs; i++)
+	{
+		args->values[i] = PG_GETARG_DATUM(first + i);
+		args->nulls[i] = PG_ARGISNULL(first + i);
+		args->types[i] = get_fn_expr_argtype(fcinfo->flinfo, first + i);
+		if (!OidIsValid(args->types[i]))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("could not determine the type of SQLite parameter %d", i + 1)));
+	}
+}
+
+void
+sqlite_bind_value(sqlite_Sqlite *sqlite, sqlite3_stmt *stmt, int param,
+				  Datum value, bool isnull, Oid typid)
+{
+	int rc;
+
+	if (isnull)
+		rc = sqlite3_bind_null(stmt, param);
+	else
+	{
+		switch (getBaseType(typid))
+		{
+			case INT2OID:
+				rc = sqlite3_bind_int64(stmt, param, DatumGetInt16(value));
+				break;
+			case INT4OID:
+				rc = sqlite3_bind_int64(stmt, param, DatumGetInt32(value));
+				break;
+			case INT8OID:
+				rc = sqlite3_bind_int64(stmt, param, DatumGetInt64(value));
+				break;
+			case FLOAT4OID:
+				rc = sqlite3_bind_double(stmt, param, DatumGetFloat4(value));
+				break;
+			case FLOAT8OID:
+				rc = sqlite3_bind_double(stmt, param, DatumGetFloat8(value));
+				break;
+			case BOOLOID:
+				rc = sqlite3_bind_int(stmt, param, DatumGetBool(value) ? 1 : 0);
+				break;
+			case TEXTOID:
+			case VARCHAROID:
+				{
+					text *t = DatumGetTextPP(value);
+
+					rc = sqlite3_bind_text(stmt, param, VARDATA_ANY(t), VARSIZE_ANY_EXHDR(t),
+										   SQLITE_TRANSIENT);
+				}
+				break;
+			case UNKNOWNOID:
+			case CSTRINGOID:
+				rc = sqlite3_bind_text(stmt, param, DatumGetCString(value), -1, SQLITE_TRANSIENT);
+				break;
+			case BYTEAOID:
+				{
+					bytea *b = DatumGetByteaPP(value);
+
+					rc = sqlite3_bind_blob(stmt, param, VARDATA_ANY(b), VARSIZE_ANY_EXHDR(b),
+										   SQLITE_TRANSIENT);
+				}
+				break;
+			default:
+				{
+					Oid typoutput;
+					bool typisvarlena;
+
+					getTypeOutputInfo(typid, &typoutput, &typisvarlena);
+					rc = sqlite3_bind_text(stmt, param, OidOutputFunctionCall(typoutput, value),
+										   -1, SQLITE_TRANSIENT);
+				}
+				break;
+		}
+	}
+
+	if (rc != SQLITE_OK)
+		ereport(ERROR, (errmsg("Failed to bind SQLite parameter %d: %s",
+							   param, sqlite3_errmsg(sqlite->db))));
+}
+
+/* Bind args to the parameters of stmt.  A statement may use fewer
+   parameters than there are shared values, since every statement of a
+   multi-statement sqlite_exec() is bound from the same values; the
+   caller checks that nused covers them once all statements ran. */
+void
+sqlite_bind_args(sqlite_Sqlite *sqlite, sqlite3_stmt *stmt, sqlite_BindArgs *args)
+{
+	int nparams = sqlite3_bind_parameter_count(stmt);
+	int i;
+
+	if (nparams > args->nargs || (nparams < args->nargs && !args->shared))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("SQLite statement has %d parameters, but %d values were given",
+						nparams, args->nargs)));
+	args->nused = Max(args->nused, nparams);
+
+	for (i = 0; i < nparams; i++)
+		sqlite_bind_value(sqlite, stmt, i + 1, args->values[i], args->nulls[i], args->types[i]);
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -0,0 +1,221 @@
+#include "sqlite.h"
+
+#include "access/detoast.h"
+#include "access/xact.h"
+#include "lib/ilist.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+/* Backend-local cache of read-only expanded databases.
+
+   Databases stored out of line are identified by their TOAST pointer.
+   A TOAST value is never modified in place, a new version of the
+   database gets a new value OID, so the pointer is a safe key for the
+   image it points to.  The raw and external sizes are part of the key
+   as well to guard against a value OID being reused after the old
+   value was vacuumed away.
+
+   Cached databases are mapped read-only and live in their own context
+   under TopMemoryContext.  A database evicted while a scan may still be
+   using it is only freed at the end of the transaction.
+
+   An entry is charged the size of its image and the memory SQLite
+   holds for its connection, page cache, schema and cached statements
+   included.  The latter grows as the database is queried and is only
+   brought up to date when the entry is looked up, so the cache may go
+   somewhat over sqlite.cache_size between lookups.
+*/
+
+int sqlite_cache_size = 65536;
+
+typedef struct sqlite_CacheKey {
+	Oid toastrelid;
+	Oid valueid;
+	int32 rawsize;
+	int32 extsize;
+} sqlite_CacheKey;
+
+typedef struct sqlite_CacheEntry {
+	sqlite_CacheKey key;
+	sqlite_Sqlite *sqlite;
+	Size size;
+	dlist_node lru_node;
+} sqlite_CacheEntry;
+
+static MemoryContext sqlite_cache_context = NULL;
+static HTAB *sqlite_cache = NULL;
+static dlist_head sqlite_cache_lru = DLIST_STATIC_INIT(sqlite_cache_lru);
+static Size sqlite_cache_used = 0;
+
+/* Databases evicted during the current transaction */
+static List *sqlite_cache_evicted = NIL;
+
+static void
+sqlite_cache_xact_callback(XactEvent event, void *arg)
+{
+	HASH_SEQ_STATUS status;
+	sqlite_CacheEntry *entry;
+	ListCell *lc;
+
+	switch (event)
+	{
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			/* Scans cut short by the error never released their statements */
+			hash_seq_init(&status, sqlite_cache);
+			while ((entry = hash_seq_search(&status)) != NULL)
+				sqlite_stmt_cache_reset(entry->sqlite);
+			/* FALLTHROUGH */
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PREPARE:
+			foreach(lc, sqlite_cache_evicted)
+				MemoryContextDelete(((sqlite_Sqlite *) lfirst(lc))->hdr.eoh_context);
+			list_free(sqlite_cache_evicted);
+			sqlite_cache_evicted = NIL;
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+sqlite_cache_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+							  SubTransactionId parentSubid, void *arg)
+{
+	HASH_SEQ_STATUS status;
+	sqlite_CacheEntry *entry;
+
+	switch (event)
+	{
+		case SUBXACT_EVENT_ABORT_SUB:
+			/* Scans cut short by the error never released their statements */
+			hash_seq_init(&status, sqlite_cache);
+			while ((entry = hash_seq_search(&status)) != NULL)
+				sqlite_stmt_cache_abort_sub(entry->sqlite, mySubid);
+			break;
+		case SUBXACT_EVENT_COMMIT_SUB:
+			hash_seq_init(&status, sqlite_cache);
+			while ((entry = hash_seq_search(&status)) != NULL)
+				sqlite_stmt_cache_commit_sub(entry->sqlite, mySubid, parentSubid);
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+sqlite_cache_init(void)
+{
+	HASHCTL ctl;
+
+	sqlite_cache_context = AllocSetContextCreate(TopMemoryContext,
+												 "SQLite database cache",
+												 ALLOCSET_DEFAULT_SIZES);
+
+	ctl.keysize = sizeof(sqlite_CacheKey);
+	ctl.entrysize = sizeof(sqlite_CacheEntry);
+	ctl.hcxt = sqlite_cache_context;
+	sqlite_cache = hash_create("SQLite database cache", 256, &ctl,
+							   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	RegisterXactCallback(sqlite_cache_xact_callback, NULL);
+	RegisterSubXactCallback(sqlite_cache_subxact_callback, NULL);
+}
+
+/* What an entry keeps in memory */
+static Size
+sqlite_cache_entry_size(sqlite_CacheEntry *entry)
+{
+	return entry->key.rawsize + sqlite_mem_account_used(entry->sqlite->mem);
+}
+
+/* Evict least recently used databases other than keep until size more
+   bytes fit */
+static void
+sqlite_cache_evict(Size size, sqlite_CacheEntry *keep)
+{
+	sqlite_CacheEntry *entry;
+	MemoryContext oldcxt;
+
+	while (!dlist_is_empty(&sqlite_cache_lru) &&
+		   sqlite_cache_used + size > (Size) sqlite_cache_size * 1024)
+	{
+		entry = dlist_head_element(sqlite_CacheEntry, lru_node, &sqlite_cache_lru);
+		if (entry == keep)
+			break;
+		dlist_delete(&entry->lru_node);
+		sqlite_cache_used -= entry->size;
+
+		oldcxt = MemoryContextSwitchTo(sqlite_cache_context);
+		sqlite_cache_evicted = lappend(sqlite_cache_evicted, entry->sqlite);
+		MemoryContextSwitchTo(oldcxt);
+
+		hash_search(sqlite_cache, &entry->key, HASH_REMOVE, NULL);
+	}
+}
+
+/* Return the cached read-only database for an out of line sqlite
+   datum.  On a miss, the database is expanded into the cache if insert
+   is set and it fits, otherwise NULL is returned. */
+sqlite_Sqlite *
+sqlite_cache_lookup(Datum d, bool insert)
+{
+	struct varlena *attr = (struct varlena *) DatumGetPointer(d);
+	struct varatt_external toast_pointer;
+	sqlite_CacheKey key;
+	sqlite_CacheEntry *entry;
+	sqlite_Sqlite *sqlite;
+	bool found;
+	Size size;
+
+	LOGF();
+
+	if (sqlite_cache_size <= 0 || !VARATT_IS_EXTERNAL_ONDISK(attr))
+		return NULL;
+
+	if (sqlite_cache == NULL)
+		sqlite_cache_init();
+
+	VARATT_EXTERNAL_GET_POINTER(toast_pointer, attr);
+	memset(&key, 0, sizeof(key));
+	key.toastrelid = toast_pointer.va_toastrelid;
+	key.valueid = toast_pointer.va_valueid;
+	key.rawsize = toast_pointer.va_rawsize;
+	key.extsize = VARATT_EXTERNAL_GET_EXTSIZE(toast_pointer);
+
+	entry = hash_search(sqlite_cache, &key, HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		/* Charge what the connection took since it was last used */
+		dlist_move_tail(&sqlite_cache_lru, &entry->lru_node);
+		sqlite_cache_used -= entry->size;
+		entry->size = sqlite_cache_entry_size(entry);
+		sqlite_cache_used += entry->size;
+		sqlite_cache_evict(0, entry);
+		return entry->sqlite;
+	}
+
+	size = key.rawsize;
+	if (!insert || size > (Size) sqlite_cache_size * 1024)
+		return NULL;
+
+	sqlite_cache_evict(size, NULL);
+
+	/* Expand outside the cache context so a failure leaks nothing */
+	sqlite = expand_sqlite_datum(d, true, CurrentMemoryContext, true);
+	entry = hash_search(sqlite_cache, &key, HASH_ENTER, &found);
+	Assert(!found);
+	MemoryContextSetParent(sqlite->hdr.eoh_context, sqlite_cache_context);
+
+	entry->sqlite = sqlite;
+	entry->size = sqlite_cache_entry_size(entry);
+	dlist_push_tail(&sqlite_cache_lru, &entry->lru_node);
+	sqlite_cache_used += entry->size;
+	return entry->sqlite;
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -0,0 +1,379 @@
+#include "sqlite.h"
+
+#include "catalog/pg_type.h"
+#include "common/int.h"
+#include "mb/pg_wchar.h"
+#include "utils/datetime.h"
+#include "utils/float.h"
+#include "utils/numeric.h"
+#include "utils/timestamp.h"
+
+/* Conversion of SQLite result columns to Postgres datums.
+
+   A converter is chosen once per result column from the type the
+   caller declared for it, then applied to every row.  Converters take
+   the value in whatever storage class SQLite has for it, and raise an
+   error for one that has no sensible conversion to the declared type
+   rather than guessing.  Text and blobs are copied using their length
+   from sqlite3_column_bytes(), without a strlen().  SQLite doesn't
+   check the text it stores, so text is verified to be valid in the
+   database encoding, without NULs, before it becomes a text datum.
+
+   Types without a converter of their own are read through their input
+   function from the SQLite text form of the value.
+*/
+
+static const char *const sqlite_storage_class_names[] = {
+	NULL, "INTEGER", "REAL", "TEXT", "BLOB", "NULL"
+};
+
+static void
+sqlite_convert_mismatch(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_DATATYPE_MISMATCH),
+			 errmsg("cannot convert SQLite %s value in column \"%s\" to type %s",
+					sqlite_storage_class_names[type],
+					sqlite3_column_name(stmt, col),
+					format_type_be(conv->typid))));
+}
+
+static Datum
+sqlite_convert_input(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	if (type == SQLITE_BLOB)
+		sqlite_convert_mismatch(stmt, col, type, conv);
+	return InputFunctionCall(&conv->input, (char *) sqlite3_column_text(stmt, col),
+							 conv->ioparam, conv->typmod);
+}
+
+static int64
+sqlite_convert_integer(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	if (type != SQLITE_INTEGER)
+		sqlite_convert_mismatch(stmt, col, type, conv);
+	return sqlite3_column_int64(stmt, col);
+}
+
+static Datum
+sqlite_convert_int2(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	int64 value = sqlite_convert_integer(stmt, col, type, conv);
+
+	if (value < PG_INT16_MIN || value > PG_INT16_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("smallint out of range")));
+	return Int16GetDatum((int16) value);
+}
+
+static Datum
+sqlite_convert_int4(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	int64 value = sqlite_convert_integer(stmt, col, type, conv);
+
+	if (value < PG_INT32_MIN || value > PG_INT32_MAX)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("integer out of range")));
+	return Int32GetDatum((int32) value);
+}
+
+static Datum
+sqlite_convert_int8(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	return Int64GetDatum(sqlite_convert_integer(stmt, col, type, conv));
+}
+
+static Datum
+sqlite_convert_float4(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	double value;
+	float4 result;
+
+	if (type != SQLITE_INTEGER && type != SQLITE_FLOAT)
+		sqlite_convert_mismatch(stmt, col, type, conv);
+	value = sqlite3_column_double(stmt, col);
+	result = (float4) value;
+	if (unlikely(isinf(result)) && !isinf(value))
+		float_overflow_error();
+	return Float4GetDatum(result);
+}
+
+static Datum
+sqlite_convert_float8(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	if (type != SQLITE_INTEGER && type != SQLITE_FLOAT)
+		sqlite_convert_mismatch(stmt, col, type, conv);
+	return Float8GetDatum(sqlite3_column_double(stmt, col));
+}
+
+static Datum
+sqlite_convert_numeric(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	Datum result;
+
+	switch (type)
+	{
+		case SQLITE_INTEGER:
+			result = NumericGetDatum(int64_to_numeric(sqlite3_column_int64(stmt, col)));
+			break;
+		case SQLITE_FLOAT:
+			result = DirectFunctionCall1(float8_numeric,
+										 Float8GetDatum(sqlite3_column_double(stmt, col)));
+			break;
+		default:
+			/* Text goes through numeric_in, which applies the typmod */
+			return sqlite_convert_input(stmt, col, type, conv);
+	}
+	if (conv->typmod >= 0)
+		result = DirectFunctionCall2(numeric, result, Int32GetDatum(conv->typmod));
+	return result;
+}
+
+static Datum
+sqlite_convert_bool(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	return BoolGetDatum(sqlite_convert_integer(stmt, col, type, conv) != 0);
+}
+
+static Datum
+sqlite_convert_text(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	const char *data;
+	int len;
+
+	if (type == SQLITE_BLOB)
+		sqlite_convert_mismatch(stmt, col, type, conv);
+	data = (const char *) sqlite3_column_text(stmt, col);
+	len = sqlite3_column_bytes(stmt, col);
+	pg_verifymbstr(data, len, false);
+	return PointerGetDatum(cstring_to_text_with_len(data, len));
+}
+
+static Datum
+sqlite_convert_bytea(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	const void *data;
+	int len;
+	bytea *result;
+
+	if (type != SQLITE_BLOB && type != SQLITE_TEXT)
+		sqlite_convert_mismatch(stmt, col, type, conv);
+	data = sqlite3_column_blob(stmt, col);
+	len = sqlite3_column_bytes(stmt, col);
+	result = (bytea *) palloc(len + VARHDRSZ);
+	SET_VARSIZE(result, len + VARHDRSZ);
+	if (len > 0)
+		memcpy(VARDATA(result), data, len);
+	return PointerGetDatum(result);
+}
+
+/* Parse a date and time in text, which SQLite writes in ISO 8601, as
+   UTC unless it names its zone.  DecodeDateTime() only accepts a zone
+   when it is given somewhere to put it, so a first pass without tells
+   whether there is one. */
+static Timestamp
+sqlite_convert_timestamp_text(sqlite3_stmt *stmt, int col, sqlite_Converter *conv)
+{
+	const char *str = (const char *) sqlite3_column_text(stmt, col);
+	char workbuf[MAXDATELEN + MAXDATEFIELDS];
+	char *field[MAXDATEFIELDS];
+	int ftype[MAXDATEFIELDS];
+	int nf;
+	int dtype;
+	int tz;
+	int *tzp = NULL;
+	struct pg_tm tt;
+	fsec_t fsec;
+	DateTimeErrorExtra extra;
+	Timestamp result;
+	int dterr;
+
+	dterr = ParseDateTime(str, workbuf, sizeof(workbuf), field, ftype, MAXDATEFIELDS, &nf);
+	if (dterr == 0)
+		dterr = DecodeDateTime(field, ftype, nf, &dtype, &tt, &fsec, NULL, &extra);
+	if (dterr == DTERR_BAD_FORMAT)
+	{
+		tzp = &tz;
+		dterr = ParseDateTime(str, workbuf, sizeof(workbuf), field, ftype, MAXDATEFIELDS, &nf);
+		if (dterr == 0)
+			dterr = DecodeDateTime(field, ftype, nf, &dtype, &tt, &fsec, tzp, &extra);
+	}
+	if (dterr != 0)
+		DateTimeParseError(dterr, &extra, str, format_type_be(conv->typid), NULL);
+
+	switch (dtype)
+	{
+		case DTK_DATE:
+			if (tm2timestamp(&tt, fsec, tzp, &result) != 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+						 errmsg("timestamp out of range: \"%s\"", str)));
+			break;
+		case DTK_EPOCH:
+			result = SetEpochTimestamp();
+			break;
+		case DTK_LATE:
+			TIMESTAMP_NOEND(result);
+			break;
+		case DTK_EARLY:
+			TIMESTAMP_NOBEGIN(result);
+			break;
+		default:
+			elog(ERROR, "unexpected dtype %d while parsing timestamp \"%s\"", dtype, str);
+	}
+	return result;
+}
+
+/* SQLite keeps dates and times as ISO 8601 text, as Unix time in an
+   INTEGER or as a Julian day number in a REAL.  All of them are taken
+   as UTC, text without a zone too, so the same conversion serves
+   timestamp and timestamptz whatever the session's TimeZone, and
+   timestamp gets the UTC time of a value that names another zone. */
+static Datum
+sqlite_convert_timestamp(sqlite3_stmt *stmt, int col, int type, sqlite_Converter *conv)
+{
+	Timestamp result;
+
+	switch (type)
+	{
+		case SQLITE_INTEGER:
+			{
+				int64 secs = sqlite3_column_int64(stmt, col);
+
+				if (pg_sub_s64_overflow(secs, (int64) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY, &secs) ||
+					pg_mul_s64_overflow(secs, USECS_PER_SEC, &result))
+					ereport(ERROR,
+							(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+							 errmsg("timestamp out of range")));
+			}
+			break;
+		case SQLITE_FLOAT:
+			{
+				/* Julian days start at noon, Postgres days at midnight */
+				double usecs = (sqlite3_column_double(stmt, col) - (POSTGRES_EPOCH_JDATE - 0.5)) *
+					SECS_PER_DAY * USECS_PER_SEC;
+
+				if (isnan(usecs) || !FLOAT8_FITS_IN_INT64(usecs))
+					ereport(ERROR,
+							(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+							 errmsg("timestamp out of range")));
+				result = (Timestamp) rint(usecs);
+			}
+			break;
+		case SQLITE_TEXT:
+			result = sqlite_convert_timestamp_text(stmt, col, conv);
+			break;
+		default:
+			sqlite_convert_mismatch(stmt, col, type, conv);
+			return (Datum) 0;
+	}
+
+	if (!TIMESTAMP_NOT_FINITE(result) && !IS_VALID_TIMESTAMP(result))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range")));
+	AdjustTimestampForTypmod(&result, conv->typmod, NULL);
+	return TimestampGetDatum(result);
+}
+
+sqlite_Converter *
+sqlite_get_converters(sqlite3_stmt *stmt, TupleDesc tupdesc)
+{
+	sqlite_Converter *converters;
+	int column_count = stmt ? sqlite3_column_count(stmt) : 0;
+	int i;
+
+	LOGF();
+
+	if (stmt != NULL && column_count != tupdesc->natts)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("SQLite query returns %d columns, but the result has %d",
+						column_count, tupdesc->natts)));
+
+	converters = palloc0(tupdesc->natts * sizeof(sqlite_Converter));
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+		sqlite_Converter *conv = &converters[i];
+		Oid infunc;
+
+		conv->typid = att->atttypid;
+		conv->typmod = att->atttypmod;
+
+		switch (conv->typid)
+		{
+			case INT2OID:
+				conv->convert = sqlite_convert_int2;
+				break;
+			case INT4OID:
+				conv->convert = sqlite_convert_int4;
+				break;
+			case INT8OID:
+				conv->convert = sqlite_convert_int8;
+				break;
+			case FLOAT4OID:
+				conv->convert = sqlite_convert_float4;
+				break;
+			case FLOAT8OID:
+				conv->convert = sqlite_convert_float8;
+				break;
+			case NUMERICOID:
+				conv->convert = sqlite_convert_numeric;
+				break;
+			case BOOLOID:
+				conv->convert = sqlite_convert_bool;
+				break;
+			case TEXTOID:
+				conv->convert = sqlite_convert_text;
+				break;
+			case VARCHAROID:
+				/* A length limit needs checking by the input function */
+				conv->convert = conv->typmod < 0 ? sqlite_convert_text : sqlite_convert_input;
+				break;
+			case BYTEAOID:
+				conv->convert = sqlite_convert_bytea;
+				break;
+			case TIMESTAMPOID:
+			case TIMESTAMPTZOID:
+				conv->convert = sqlite_convert_timestamp;
+				break;
+			default:
+				/* jsonb, json, date, uuid, domains and anything else */
+				conv->convert = sqlite_convert_input;
+				break;
+		}
+
+		getTypeInputInfo(conv->typid, &infunc, &conv->ioparam);
+		fmgr_info(infunc, &conv->input);
+	}
+	return converters;
+}
+
+void
+sqlite_convert_row(sqlite3_stmt *stmt, sqlite_Converter *converters, int natts,
+				   Datum *values, bool *nulls)
+{
+	int i;
+
+	for (i = 0; i < natts; i++)
+	{
+		int type = sqlite3_column_type(stmt, i);
+
+		if (type == SQLITE_NULL)
+		{
+			values[i] = (Datum) 0;
+			nulls[i] = true;
+			continue;
+		}
+		nulls[i] = false;
+		values[i] = converters[i].convert(stmt, i, type, &converters[i]);
+	}
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
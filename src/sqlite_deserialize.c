@@ -1,42 +1,115 @@
 #include "sqlite.h"
 
+#include "libpq/pqformat.h"
+
 PG_FUNCTION_INFO_V1(sqlite_deserialize);
+PG_FUNCTION_INFO_V1(sqlite_recv);
 
-Datum
-sqlite_deserialize(PG_FUNCTION_ARGS)
+/* Size of the header at the start of every SQLite database file */
+#define SQLITE_HEADER_SIZE 100
+
+/* Check the database header of an image, so a stray value is rejected
+   before SQLite ever parses it.  An empty image is an empty database. */
+static void
+sqlite_check_header(const unsigned char *image, Size size)
+{
+	uint32 page_size;
+
+	if (size == 0)
+		return;
+
+	if (size < SQLITE_HEADER_SIZE || memcmp(image, "SQLite format 3", 16) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid sqlite database image"),
+				 errdetail("The image does not start with a SQLite database header.")));
+
+	/* Big endian, with 1 standing for 65536 */
+	page_size = (image[16] << 8) | image[17];
+	if (page_size == 1)
+		page_size = 65536;
+	if (page_size < 512 || page_size > 65536 || (page_size & (page_size - 1)) != 0 ||
+		size % page_size != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid sqlite database image"),
+				 errdetail("The image size %zu does not fit its page size %u.",
+						   size, page_size)));
+}
+
+/* Make a new database from a copy of a database file image, checking
+   that the image is a well formed database. */
+sqlite_Sqlite *
+sqlite_deserialize_image(const char *data, Size size)
 {
 	sqlite_Sqlite *sqlite;
-	sqlite3 *db;
-	bytea *input;
-	char *data;
-	size_t size;
+	unsigned char *image;
+	sqlite3_stmt *stmt;
+	const char *result;
+	instr_time start;
+	int rc;
 
 	LOGF();
 
-	input = PG_GETARG_BYTEA_P(0);
-    data = VARDATA(input);
-    size = VARSIZE(input) - VARHDRSZ;
+	SQLITE_STATS_START(start);
+	sqlite_check_header((const unsigned char *) data, size);
 
-    if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+	sqlite = new_expanded_sqlite(CurrentMemoryContext, false);
+	image = MemoryContextAllocHuge(sqlite->hdr.eoh_context, Max(size, 1));
+	memcpy(image, data, size);
+	sqlite_store_set_image(&sqlite->store, image, size);
+
+	/* quick_check walks every b-tree page, but skips the index
+	   consistency checks of a full integrity_check */
+	if (sqlite3_prepare_v2(sqlite->db, "PRAGMA quick_check(1)", -1, &stmt, NULL) != SQLITE_OK)
 	{
-        ereport(ERROR, (errmsg("Failed to create SQLite in-memory database: %s",
-							   sqlite3_errmsg(db))));
-    }
-
-    if (sqlite3_deserialize(
-			db,
-			"main",
-			(unsigned char *)data,
-			size,
-			size,
-			SQLITE_DESERIALIZE_RESIZEABLE
-			) != SQLITE_OK)
+		sqlite_store_check_error(&sqlite->store);
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid sqlite database image: %s", sqlite3_errmsg(sqlite->db))));
+	}
+	rc = sqlite3_step(stmt);
+	result = rc == SQLITE_ROW ? (const char *) sqlite3_column_text(stmt, 0) : NULL;
+	if (result == NULL || strcmp(result, "ok") != 0)
 	{
-        ereport(ERROR,
-				errmsg("could not deserialize SQLite database: %s", sqlite3_errmsg(db)));
+		char *msg = pstrdup(result != NULL ? result : sqlite3_errmsg(sqlite->db));
+
+		sqlite3_finalize(stmt);
+		sqlite_store_check_error(&sqlite->store);
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid sqlite database image: %s", msg)));
 	}
+	sqlite3_finalize(stmt);
+	sqlite_stats_add(SQLITE_STAT_DESERIALIZE, size, start);
+	return sqlite;
+}
+
+Datum
+sqlite_deserialize(PG_FUNCTION_ARGS)
+{
+	sqlite_Sqlite *sqlite;
+
+	LOGF();
+
+	/* The bytea becomes the base image of the page store, pages are
+	   only copied when they are written. */
+ 	sqlite = expand_sqlite_datum(PG_GETARG_DATUM(0), false, CurrentMemoryContext, false);
+	SQLITE_RETURN(sqlite);
+}
+
+/* Binary input, the database file image as sent by sqlite_send() */
+Datum
+sqlite_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+	sqlite_Sqlite *sqlite;
+	int size;
+
+	LOGF();
 
- 	sqlite = new_expanded_sqlite(NULL, CurrentMemoryContext, db);
+	size = buf->len - buf->cursor;
+	sqlite = sqlite_deserialize_image(pq_getmsgbytes(buf, size), size);
 	SQLITE_RETURN(sqlite);
 }
 
@@ -0,0 +1,103 @@
+#include "sqlite.h"
+
+#include "mb/pg_wchar.h"
+#include "miscadmin.h"
+
+PG_FUNCTION_INFO_V1(sqlite_dump);
+
+typedef struct sqlite_DumpState {
+	ReturnSetInfo *rsinfo;
+	MemoryContext cxt;
+	uint64 bytes;
+	ErrorData *error;
+} sqlite_DumpState;
+
+/* Put each statement of the dump into the result as a row of its own.
+   The tuplestore spills to disk, so a dump of any size streams through
+   without being built up in memory.  Errors can't be thrown through
+   SQLite, so they are kept in the state for sqlite_dump() to rethrow
+   and nothing more is put once one has been raised. */
+static int
+sqlite_dump_callback(const char *str, int len, void *arg)
+{
+	sqlite_DumpState *state = (sqlite_DumpState *) arg;
+	ReturnSetInfo *rsinfo = state->rsinfo;
+
+	if (state->error != NULL)
+		return 1;
+
+	PG_TRY();
+	{
+		Datum value;
+		bool isnull = false;
+
+		CHECK_FOR_INTERRUPTS();
+
+		pg_verifymbstr(str, len, false);
+		value = PointerGetDatum(cstring_to_text_with_len(str, len));
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, &value, &isnull);
+		pfree(DatumGetPointer(value));
+		state->bytes += len;
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(state->cxt);
+		state->error = CopyErrorData();
+		FlushErrorState();
+	}
+	PG_END_TRY();
+
+	return state->error != NULL;
+}
+
+/* Dump a database, or one table of it, as SQL statements, one per row */
+Datum
+sqlite_dump(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	sqlite_Sqlite *sqlite;
+	char *table = NULL;
+	sqlite_DumpState state;
+	instr_time start;
+	int rc;
+
+	LOGF();
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	if (PG_ARGISNULL(0))
+		return (Datum) 0;
+
+	sqlite = SQLITE_GETARG_RO(0);
+	if (!PG_ARGISNULL(1))
+		table = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+	state.rsinfo = rsinfo;
+	state.cxt = CurrentMemoryContext;
+	state.bytes = 0;
+	state.error = NULL;
+	SQLITE_STATS_START(start);
+
+	rc = sqlite3_db_dump(sqlite->db, "main", table, sqlite_dump_callback, &state);
+
+	if (rc != SQLITE_OK || state.error != NULL)
+	{
+		/* Leave no statement or transaction of the dump behind on a
+		   database that may be cached */
+		sqlite_stmt_cache_reset(sqlite);
+		if (!sqlite3_get_autocommit(sqlite->db))
+			sqlite3_exec(sqlite->db, "ROLLBACK", NULL, NULL, NULL);
+		if (state.error != NULL)
+			ReThrowError(state.error);
+		sqlite_store_check_error(&sqlite->store);
+		ereport(ERROR, (errmsg("Failed to dump sqlite: %s",
+							   sqlite3_errmsg(sqlite->db))));
+	}
+	sqlite_stats_add(SQLITE_STAT_DUMP, state.bytes, start);
+	return (Datum) 0;
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -2,21 +2,102 @@
 
 PG_FUNCTION_INFO_V1(sqlite_exec);
 
+/* Whether stmt can run against a read-only database.  Transaction
+   control statements count as read-only to SQLite, but a transaction
+   begun on the read-only database would not carry over to the copy
+   made for a later write, so only statements returning rows qualify. */
+static bool
+sqlite_exec_stmt_readonly(sqlite3_stmt *stmt)
+{
+	return sqlite3_stmt_readonly(stmt) && sqlite3_column_count(stmt) > 0;
+}
+
 Datum
 sqlite_exec(PG_FUNCTION_ARGS)
 {
 	sqlite_Sqlite *sqlite;
     text *query;
-    char *msg = NULL;
+    const char *sql;
+    const char *tail;
+    sqlite3_stmt *stmt;
+    sqlite_BindArgs args;
+    uint64 writes;
+    bool failed;
+    int rc;
 	LOGF();
-	sqlite = SQLITE_GETARG(0);
+
+	/* The variadic variant binding parameters isn't strict */
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+
+	/* Start out reading the database in place, a writable copy is only
+	   made once a statement may write to it */
+	sqlite = SQLITE_GETARG_RO(0);
 	query = PG_GETARG_TEXT_PP(1);
+    sql = text_to_cstring(query);
+    sqlite_get_bind_args(fcinfo, 2, &args);
+    args.shared = true;
+    writes = sqlite->store.writes;
 
-    // Execute the query
-    if (sqlite3_exec(sqlite->db, text_to_cstring(query), NULL, NULL, &msg) != SQLITE_OK)
-	{
-        ereport(ERROR, (errmsg("Failed to execute query: %s", msg)));
+    // Execute each statement in the query, reusing cached statements
+    while (sql != NULL)
+    {
+        /* A statement denied on the read-only database, or failing
+           there, is prepared again on a writable copy */
+        stmt = sqlite_prepare_cached_ext(sqlite, sql, &tail, sqlite->readonly ? &failed : NULL);
+        if ((sqlite->readonly && failed) ||
+            (stmt != NULL && sqlite->readonly && !sqlite_exec_stmt_readonly(stmt)))
+        {
+            if (stmt != NULL)
+                sqlite_release_stmt(sqlite, stmt);
+            sqlite = sqlite_copy_writable(sqlite);
+            writes = sqlite->store.writes;
+            stmt = sqlite_prepare_cached(sqlite, sql, &tail);
+        }
+        if (stmt != NULL)
+        {
+            PG_TRY();
+            {
+                sqlite_bind_args(sqlite, stmt, &args);
+            }
+            PG_CATCH();
+            {
+                sqlite_release_stmt(sqlite, stmt);
+                PG_RE_THROW();
+            }
+            PG_END_TRY();
+
+            while ((rc = sqlite_step(stmt)) == SQLITE_ROW)
+                ;
+            if (rc != SQLITE_DONE)
+            {
+                char *msg = pstrdup(sqlite3_errmsg(sqlite->db));
+
+                sqlite_release_stmt(sqlite, stmt);
+                sqlite_store_check_error(&sqlite->store);
+                ereport(ERROR, (errmsg("Failed to execute query: %s", msg)));
+            }
+            sqlite_release_stmt(sqlite, stmt);
+        }
+        sql = tail;
     }
+
+    if (args.nused < args.nargs)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("SQLite statements have %d parameters, but %d values were given",
+                        args.nused, args.nargs)));
+
+    /* SQLite only writes to the database file when a change commits,
+       a statement that changed nothing leaves it alone.  The data
+       version can't tell, it moves on every write transaction.  If no
+       page was written and no transaction is left open, the argument
+       is returned as it came in, so a stored database keeps its TOAST
+       pointer and is not written again. */
+    if (sqlite->readonly ||
+        (sqlite->store.writes == writes && sqlite3_get_autocommit(sqlite->db)))
+        PG_RETURN_DATUM(PG_GETARG_DATUM(0));
+
     SQLITE_RETURN(sqlite);
 
 }
@@ -0,0 +1,201 @@
+#include "sqlite.h"
+
+#include "miscadmin.h"
+
+PG_FUNCTION_INFO_V1(sqlite_explain);
+
+/* The plan of a query inside a database, and with analyze what running
+   it cost the SQLite VM.
+
+   The query is prepared through the statement cache like it is by
+   sqlite_query(), so the plan shown is the one of the statement
+   sqlite_query() would run.  Only the first statement of the query is
+   explained.  The plan comes from EXPLAIN QUERY PLAN, each node
+   indented below its parent.  Analyze runs the statement to completion
+   and adds its counters from sqlite3_stmt_status(), which are reset
+   first since a cached statement keeps counting across runs.
+*/
+
+static void
+sqlite_explain_line(ReturnSetInfo *rsinfo, const char *line)
+{
+	Datum value = CStringGetTextDatum(line);
+	bool isnull = false;
+
+	tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, &value, &isnull);
+	pfree(DatumGetPointer(value));
+}
+
+/* Put the EXPLAIN QUERY PLAN of stmt into the result.  Nodes come out
+   in tree order, each after its parent. */
+static void
+sqlite_explain_plan(ReturnSetInfo *rsinfo, sqlite_Sqlite *sqlite, sqlite3_stmt *stmt)
+{
+	char *sql = psprintf("EXPLAIN QUERY PLAN %s", sqlite3_sql(stmt));
+	sqlite3_stmt *plan;
+	StringInfoData line;
+	int *ids;
+	int *depths;
+	int nnodes = 0;
+	int maxnodes = 16;
+	int rc;
+
+	plan = sqlite_prepare_cached(sqlite, sql, NULL);
+	if (plan == NULL)
+		return;
+
+	ids = palloc(maxnodes * sizeof(int));
+	depths = palloc(maxnodes * sizeof(int));
+	initStringInfo(&line);
+
+	PG_TRY();
+	{
+		while ((rc = sqlite_step(plan)) == SQLITE_ROW)
+		{
+			int id = sqlite3_column_int(plan, 0);
+			int parent = sqlite3_column_int(plan, 1);
+			int depth = 0;
+			int i;
+
+			/* Parents always come before their children */
+			for (i = nnodes - 1; i >= 0; i--)
+			{
+				if (ids[i] == parent)
+				{
+					depth = depths[i] + 1;
+					break;
+				}
+			}
+
+			if (nnodes == maxnodes)
+			{
+				maxnodes *= 2;
+				ids = repalloc(ids, maxnodes * sizeof(int));
+				depths = repalloc(depths, maxnodes * sizeof(int));
+			}
+			ids[nnodes] = id;
+			depths[nnodes] = depth;
+			nnodes++;
+
+			resetStringInfo(&line);
+			if (depth > 0)
+				appendStringInfoSpaces(&line, depth * 6 - 4);
+			appendStringInfo(&line, "%s%s", depth > 0 ? "->  " : "",
+							 (const char *) sqlite3_column_text(plan, 3));
+			sqlite_explain_line(rsinfo, line.data);
+		}
+		if (rc != SQLITE_DONE)
+		{
+			sqlite_store_check_error(&sqlite->store);
+			ereport(ERROR, (errmsg("Failed to explain SQLite query: %s", sqlite3_errmsg(sqlite->db))));
+		}
+	}
+	PG_FINALLY();
+	{
+		sqlite_release_stmt(sqlite, plan);
+	}
+	PG_END_TRY();
+
+	pfree(line.data);
+	pfree(ids);
+	pfree(depths);
+	pfree(sql);
+}
+
+/* Run stmt to completion and put its counters into the result */
+static void
+sqlite_explain_analyze(ReturnSetInfo *rsinfo, sqlite_Sqlite *sqlite, sqlite3_stmt *stmt)
+{
+	static const struct {
+		int op;
+		const char *label;
+	} counters[] = {
+		{SQLITE_STMTSTATUS_FULLSCAN_STEP, "Full Scan Steps"},
+		{SQLITE_STMTSTATUS_SORT, "Sorts"},
+		{SQLITE_STMTSTATUS_AUTOINDEX, "Autoindexes"},
+		{SQLITE_STMTSTATUS_VM_STEP, "VM Steps"},
+		{SQLITE_STMTSTATUS_REPREPARE, "Reprepares"},
+	};
+	instr_time start;
+	instr_time duration;
+	int64 rows = 0;
+	int rc;
+	int i;
+
+	/* The database is an argument, running a write on it would change
+	   a value the caller still has.  Transaction control statements
+	   count as read-only to SQLite but would leave a transaction open
+	   on it, so only statements returning rows qualify. */
+	if (!sqlite3_stmt_readonly(stmt) || sqlite3_column_count(stmt) == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("sqlite_explain() can only analyze read-only statements")));
+
+	for (i = 0; i < lengthof(counters); i++)
+		sqlite3_stmt_status(stmt, counters[i].op, 1);
+
+	INSTR_TIME_SET_CURRENT(start);
+	while ((rc = sqlite_step(stmt)) == SQLITE_ROW)
+	{
+		CHECK_FOR_INTERRUPTS();
+		rows++;
+	}
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	if (rc != SQLITE_DONE)
+	{
+		sqlite_store_check_error(&sqlite->store);
+		ereport(ERROR, (errmsg("Failed to execute SQLite query: %s", sqlite3_errmsg(sqlite->db))));
+	}
+
+	sqlite_explain_line(rsinfo, psprintf("Rows: " INT64_FORMAT, rows));
+	for (i = 0; i < lengthof(counters); i++)
+		sqlite_explain_line(rsinfo, psprintf("%s: %d", counters[i].label,
+											 sqlite3_stmt_status(stmt, counters[i].op, 0)));
+	sqlite_explain_line(rsinfo, psprintf("Memory Used: %d bytes",
+										 sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_MEMUSED, 0)));
+	sqlite_explain_line(rsinfo, psprintf("Execution Time: %.3f ms",
+										 INSTR_TIME_GET_MILLISEC(duration)));
+}
+
+Datum
+sqlite_explain(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	sqlite_Sqlite *sqlite;
+	sqlite3_stmt *stmt;
+	char *query;
+	bool analyze;
+
+	LOGF();
+
+	InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+	sqlite = SQLITE_GETARG_RO(0);
+	query = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	analyze = PG_GETARG_BOOL(2);
+
+	stmt = sqlite_prepare_cached(sqlite, query, NULL);
+	if (stmt == NULL)
+		return (Datum) 0;
+
+	PG_TRY();
+	{
+		sqlite_explain_plan(rsinfo, sqlite, stmt);
+		if (analyze)
+			sqlite_explain_analyze(rsinfo, sqlite, stmt);
+	}
+	PG_FINALLY();
+	{
+		sqlite_release_stmt(sqlite, stmt);
+	}
+	PG_END_TRY();
+
+	return (Datum) 0;
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -0,0 +1,445 @@
+#include "sqlite.h"
+
+#include "access/htup_details.h"
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/memutils.h"
+#include "utils/typcache.h"
+
+/* Bulk loading of rows into a table of a sqlite database.
+
+   A single INSERT is prepared for the table and every row is bound to
+   it and stepped, all inside one SQLite transaction, so loading a
+   large number of rows costs one parse and one commit instead of one
+   of each per row.  Rows come from an array of a composite type, one
+   row per element with a value per attribute, or from an array of a
+   scalar type for a table with a single column.
+
+   The sqlite_agg() aggregate loads rows the same way as they stream
+   in.  Its transition state is the expanded database itself, kept in
+   the aggregate context with the load transaction open, so no row is
+   ever copied into an intermediate form.  The final function commits.
+*/
+
+PG_FUNCTION_INFO_V1(sqlite_insert);
+PG_FUNCTION_INFO_V1(sqlite_agg_transfn);
+PG_FUNCTION_INFO_V1(sqlite_agg_finalfn);
+
+/* What sqlite_agg_transfn() knows about the rows it is loading, kept
+   in fn_extra for as long as the row type and table stay the same,
+   along with the database the table was last created in */
+typedef struct sqlite_AggInfo {
+	Oid typid;
+	int32 typmod;
+	char *table;
+	TupleDesc tupdesc;
+	char *create_sql;
+	sqlite_Sqlite *created;
+	char *insert_sql;
+	Datum *values;
+	bool *nulls;
+} sqlite_AggInfo;
+
+/* Run a transaction control statement */
+static void
+sqlite_insert_exec(sqlite_Sqlite *sqlite, const char *sql)
+{
+	char *msg = NULL;
+
+	if (sqlite3_exec(sqlite->db, sql, NULL, NULL, &msg) != SQLITE_OK)
+	{
+		sqlite_store_check_error(&sqlite->store);
+		ereport(ERROR, (errmsg("Failed to execute %s: %s", sql, msg)));
+	}
+}
+
+/* Quote an identifier for SQLite */
+static char *
+sqlite_quote_identifier(const char *name)
+{
+	char *quoted = sqlite3_mprintf("\"%w\"", name);
+	char *result;
+
+	if (quoted == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory")));
+	result = pstrdup(quoted);
+	sqlite3_free(quoted);
+	return result;
+}
+
+/* Build the INSERT statement for a table with ncolumns columns */
+static char *
+sqlite_insert_sql(const char *table, int ncolumns)
+{
+	StringInfoData sql;
+	int i;
+
+	initStringInfo(&sql);
+	appendStringInfo(&sql, "INSERT INTO %s VALUES (", sqlite_quote_identifier(table));
+	for (i = 0; i < ncolumns; i++)
+		appendStringInfoString(&sql, i == 0 ? "?" : ", ?");
+	appendStringInfoChar(&sql, ')');
+	return sql.data;
+}
+
+/* The declared SQLite type of a column holding Postgres type typid,
+   matching how sqlite_bind_value() binds it */
+static const char *
+sqlite_column_type(Oid typid)
+{
+	switch (getBaseType(typid))
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case BOOLOID:
+			return "INTEGER";
+		case FLOAT4OID:
+		case FLOAT8OID:
+			return "REAL";
+		case NUMERICOID:
+			return "NUMERIC";
+		case BYTEAOID:
+			return "BLOB";
+		default:
+			return "TEXT";
+	}
+}
+
+/* Build a CREATE TABLE statement for rows of tupdesc */
+static char *
+sqlite_create_sql(const char *table, TupleDesc tupdesc)
+{
+	StringInfoData sql;
+	bool first = true;
+	int i;
+
+	initStringInfo(&sql);
+	appendStringInfo(&sql, "CREATE TABLE IF NOT EXISTS %s (", sqlite_quote_identifier(table));
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+
+		if (att->attisdropped)
+			continue;
+		appendStringInfo(&sql, "%s%s %s", first ? "" : ", ",
+						 sqlite_quote_identifier(NameStr(att->attname)),
+						 sqlite_column_type(att->atttypid));
+		first = false;
+	}
+	appendStringInfoChar(&sql, ')');
+	return sql.data;
+}
+
+/* Bind the attributes of a composite row to the parameters of stmt */
+static void
+sqlite_insert_bind_row(sqlite_Sqlite *sqlite, sqlite3_stmt *stmt, HeapTupleHeader row,
+					   TupleDesc tupdesc, Datum *values, bool *nulls)
+{
+	HeapTupleData tuple;
+	int param = 1;
+	int i;
+
+	tuple.t_len = HeapTupleHeaderGetDatumLength(row);
+	ItemPointerSetInvalid(&tuple.t_self);
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data = row;
+	heap_deform_tuple(&tuple, tupdesc, values, nulls);
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+
+		if (att->attisdropped)
+			continue;
+		sqlite_bind_value(sqlite, stmt, param++, values[i], nulls[i], att->atttypid);
+	}
+}
+
+Datum
+sqlite_insert(PG_FUNCTION_ARGS)
+{
+	sqlite_Sqlite *sqlite;
+	char *table;
+	ArrayType *rows;
+	Oid element_type;
+	bool composite;
+	TupleDesc tupdesc = NULL;
+	int ncolumns = 1;
+	Datum *values = NULL;
+	bool *nulls = NULL;
+	ArrayIterator iterator;
+	Datum row;
+	bool isnull;
+	sqlite3_stmt *volatile stmt;
+	MemoryContext rowcontext;
+	MemoryContext oldcontext;
+	int64 nrows = 0;
+	int rc;
+
+	LOGF();
+
+	sqlite = SQLITE_GETARG(0);
+	table = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	rows = PG_GETARG_ARRAYTYPE_P(2);
+	element_type = ARR_ELEMTYPE(rows);
+	composite = type_is_rowtype(element_type);
+
+	if (ArrayGetNItems(ARR_NDIM(rows), ARR_DIMS(rows)) == 0)
+		SQLITE_RETURN(sqlite);
+
+	/* Every row of an array has the same type, so the INSERT can be
+	   built from the first one */
+	if (composite)
+	{
+		HeapTupleHeader header = NULL;
+		int i;
+
+		iterator = array_create_iterator(rows, 0, NULL);
+		while (array_iterate(iterator, &row, &isnull))
+		{
+			if (!isnull)
+			{
+				header = DatumGetHeapTupleHeader(row);
+				break;
+			}
+		}
+		array_free_iterator(iterator);
+		if (header == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("rows to insert into \"%s\" are null", table)));
+
+		/* Anonymous records carry their row type in each element */
+		tupdesc = lookup_rowtype_tupdesc_copy(HeapTupleHeaderGetTypeId(header),
+											  HeapTupleHeaderGetTypMod(header));
+		ncolumns = 0;
+		for (i = 0; i < tupdesc->natts; i++)
+			if (!TupleDescAttr(tupdesc, i)->attisdropped)
+				ncolumns++;
+		values = palloc(tupdesc->natts * sizeof(Datum));
+		nulls = palloc(tupdesc->natts * sizeof(bool));
+	}
+
+	stmt = sqlite_prepare_cached(sqlite, sqlite_insert_sql(table, ncolumns), NULL);
+	if (stmt == NULL)
+		ereport(ERROR, (errmsg("Failed to prepare insert into \"%s\"", table)));
+
+	/* Output functions of values bound as text allocate for every row */
+	rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "sqlite_insert row",
+									   ALLOCSET_SMALL_SIZES);
+
+	sqlite_insert_exec(sqlite, "BEGIN");
+	PG_TRY();
+	{
+		iterator = array_create_iterator(rows, 0, NULL);
+		while (array_iterate(iterator, &row, &isnull))
+		{
+			CHECK_FOR_INTERRUPTS();
+			nrows++;
+
+			oldcontext = MemoryContextSwitchTo(rowcontext);
+			if (!composite)
+				sqlite_bind_value(sqlite, stmt, 1, row, isnull, element_type);
+			else if (isnull)
+				ereport(ERROR,
+						(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						 errmsg("row " INT64_FORMAT " to insert into \"%s\" is null",
+								nrows, table)));
+			else
+			{
+				HeapTupleHeader header = DatumGetHeapTupleHeader(row);
+
+				if (HeapTupleHeaderGetTypeId(header) != tupdesc->tdtypeid ||
+					HeapTupleHeaderGetTypMod(header) != tupdesc->tdtypmod)
+					ereport(ERROR,
+							(errcode(ERRCODE_DATATYPE_MISMATCH),
+							 errmsg("rows to insert into \"%s\" must all have the same type",
+									table)));
+				sqlite_insert_bind_row(sqlite, stmt, header, tupdesc, values, nulls);
+			}
+			MemoryContextSwitchTo(oldcontext);
+
+			if ((rc = sqlite_step(stmt)) != SQLITE_DONE)
+			{
+				sqlite_store_check_error(&sqlite->store);
+				ereport(ERROR,
+						(errmsg("Failed to insert row " INT64_FORMAT " into \"%s\": %s",
+								nrows, table, sqlite3_errmsg(sqlite->db))));
+			}
+			sqlite3_reset(stmt);
+			MemoryContextReset(rowcontext);
+		}
+		array_free_iterator(iterator);
+
+		sqlite_release_stmt(sqlite, stmt);
+		stmt = NULL;
+		sqlite_insert_exec(sqlite, "COMMIT");
+	}
+	PG_CATCH();
+	{
+		if (stmt != NULL)
+			sqlite_release_stmt(sqlite, stmt);
+		if (!sqlite3_get_autocommit(sqlite->db))
+			sqlite3_exec(sqlite->db, "ROLLBACK", NULL, NULL, NULL);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	MemoryContextDelete(rowcontext);
+	SQLITE_RETURN(sqlite);
+}
+
+/* Return the cached description of the rows loaded by sqlite_agg(),
+   building it when called with a new row type or table */
+static sqlite_AggInfo *
+sqlite_agg_get_info(FunctionCallInfo fcinfo, const char *table, HeapTupleHeader row)
+{
+	sqlite_AggInfo *info = (sqlite_AggInfo *) fcinfo->flinfo->fn_extra;
+	Oid typid = HeapTupleHeaderGetTypeId(row);
+	int32 typmod = HeapTupleHeaderGetTypMod(row);
+	MemoryContext oldcontext;
+	int ncolumns = 0;
+	int i;
+
+	if (info != NULL && info->typid == typid && info->typmod == typmod &&
+		strcmp(info->table, table) == 0)
+		return info;
+
+	oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	if (info == NULL)
+		info = palloc0(sizeof(sqlite_AggInfo));
+	else
+	{
+		pfree(info->table);
+		FreeTupleDesc(info->tupdesc);
+		pfree(info->create_sql);
+		pfree(info->insert_sql);
+		pfree(info->values);
+		pfree(info->nulls);
+	}
+
+	info->typid = typid;
+	info->typmod = typmod;
+	info->table = pstrdup(table);
+	info->tupdesc = lookup_rowtype_tupdesc_copy(typid, typmod);
+	for (i = 0; i < info->tupdesc->natts; i++)
+		if (!TupleDescAttr(info->tupdesc, i)->attisdropped)
+			ncolumns++;
+	info->create_sql = sqlite_create_sql(table, info->tupdesc);
+	info->created = NULL;
+	info->insert_sql = sqlite_insert_sql(table, ncolumns);
+	info->values = palloc(info->tupdesc->natts * sizeof(Datum));
+	info->nulls = palloc(info->tupdesc->natts * sizeof(bool));
+	MemoryContextSwitchTo(oldcontext);
+
+	fcinfo->flinfo->fn_extra = info;
+	return info;
+}
+
+/* Transition function of sqlite_agg(table, row): insert row into table
+   of the state database, creating the database on the first row and
+   the table on the first row for it. */
+Datum
+sqlite_agg_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	sqlite_Sqlite *sqlite;
+	sqlite_AggInfo *info;
+	HeapTupleHeader row;
+	char *table;
+	sqlite3_stmt *stmt;
+	int rc;
+
+	LOGF();
+
+	if (!AggCheckCallContext(fcinfo, &aggcontext))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("sqlite_agg_transfn called in non-aggregate context")));
+
+	/* The database lives in the aggregate context, where the executor
+	   keeps the state without copying it between rows */
+	if (PG_ARGISNULL(0))
+		sqlite = new_expanded_sqlite(aggcontext, false);
+	else if (VARATT_IS_EXTERNAL_EXPANDED_RW(DatumGetPointer(PG_GETARG_DATUM(0))))
+		sqlite = SqliteGetEOHP(PG_GETARG_DATUM(0));
+	else
+		sqlite = expand_sqlite_datum(PG_GETARG_DATUM(0), true, aggcontext, false);
+	sqlite_mem_enter(sqlite->mem);
+
+	if (PG_ARGISNULL(1))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("sqlite_agg table name must not be null")));
+	if (PG_ARGISNULL(2))
+		SQLITE_RETURN(sqlite);
+
+	table = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	row = PG_GETARG_HEAPTUPLEHEADER(2);
+	info = sqlite_agg_get_info(fcinfo, table, row);
+
+	/* Rows load in one transaction, opened by the first row and
+	   committed by the final function */
+	if (sqlite3_get_autocommit(sqlite->db))
+	{
+		sqlite_insert_exec(sqlite, "BEGIN");
+		info->created = NULL;
+	}
+
+	/* Rows of one group can go to several tables, and rows of several
+	   groups can interleave, so the table is created whenever the rows
+	   move to a new table or database */
+	if (info->created != sqlite)
+	{
+		sqlite_insert_exec(sqlite, info->create_sql);
+		info->created = sqlite;
+	}
+
+	stmt = sqlite_prepare_cached(sqlite, info->insert_sql, NULL);
+	PG_TRY();
+	{
+		sqlite_insert_bind_row(sqlite, stmt, row, info->tupdesc, info->values, info->nulls);
+		if ((rc = sqlite_step(stmt)) != SQLITE_DONE)
+		{
+			sqlite_store_check_error(&sqlite->store);
+			ereport(ERROR,
+					(errmsg("Failed to insert row into \"%s\": %s",
+							table, sqlite3_errmsg(sqlite->db))));
+		}
+	}
+	PG_FINALLY();
+	{
+		sqlite_release_stmt(sqlite, stmt);
+	}
+	PG_END_TRY();
+
+	SQLITE_RETURN(sqlite);
+}
+
+/* Final function of sqlite_agg(): commit the load and hand the
+   database over to the caller. */
+Datum
+sqlite_agg_finalfn(PG_FUNCTION_ARGS)
+{
+	sqlite_Sqlite *sqlite;
+
+	LOGF();
+
+	sqlite = SQLITE_GETARG(0);
+	if (!sqlite3_get_autocommit(sqlite->db))
+		sqlite_insert_exec(sqlite, "COMMIT");
+
+	/* The state is not used again once finalized, so rather than copy
+	   the database it is moved out of the aggregate context */
+	MemoryContextSetParent(sqlite->hdr.eoh_context, CurrentMemoryContext);
+	SQLITE_RETURN(sqlite);
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
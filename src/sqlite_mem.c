@@ -0,0 +1,229 @@
+#include "sqlite.h"
+
+#include "utils/memutils.h"
+
+/* SQLite memory allocation from a Postgres memory context.
+
+   Everything SQLite allocates, page caches, prepared statements and
+   sorter memory included, comes from one "SQLite" context under
+   TopMemoryContext, so it shows up in pg_backend_memory_contexts and
+   counts towards the backend's memory use like any other.  Allocation
+   failures are returned to SQLite as NULL, which it reports as
+   SQLITE_NOMEM, rather than raised from inside SQLite.
+
+   Each allocation is prefixed with its size, since SQLite asks for the
+   size of its allocations and a chunk's space in a context includes
+   its overhead, and with the account of the database it is charged to.
+
+   SQLite doesn't say which connection it allocates for.  The database
+   a function was last handed, see sqlite_mem_enter(), is the one
+   SQLite works on, since every function runs its statements to the end
+   before it returns, so allocations are charged to its account.  An
+   allocation that would take a database past sqlite.max_memory_per_db
+   fails, whatever it is for: page cache, schema, statements, sorts or
+   temporary b-trees.  The page cache is kept to half of the limit, so
+   a large database still leaves room to run queries.  A chunk stays
+   charged to the account it was allocated from until it is freed, an
+   account is freed once its database is closed and its last chunk is
+   gone.
+
+   SQLite only calls these from the backend's own thread, as no
+   connection is ever allowed worker threads.
+
+   sqlite.soft_heap_limit bounds all of SQLite's memory in the backend,
+   SQLite frees cache pages to stay below it.
+*/
+
+int sqlite_max_memory_per_db = 0;
+int sqlite_soft_heap_limit = 0;
+
+struct sqlite_MemAccount {
+	/* Bytes allocated and chunks not yet freed */
+	Size used;
+	int nchunks;
+	/* Set once the database is closed */
+	bool closed;
+};
+
+typedef struct sqlite_MemChunk {
+	Size size;
+	sqlite_MemAccount *account;
+} sqlite_MemChunk;
+
+static MemoryContext sqlite_mem_context = NULL;
+
+/* The account allocations are charged to, if any */
+static sqlite_MemAccount *sqlite_mem_current = NULL;
+
+/* Size of the prefix, which keeps allocations aligned */
+#define SQLITE_MEM_HEADER MAXALIGN(sizeof(sqlite_MemChunk))
+
+#define SQLITE_MEM_CHUNK(ptr) ((sqlite_MemChunk *) ((char *) (ptr) - SQLITE_MEM_HEADER))
+
+static void *
+sqlite_mem_alloc(sqlite_MemAccount *account, int size)
+{
+	sqlite_MemChunk *chunk;
+
+	if (account != NULL && sqlite_max_memory_per_db > 0 &&
+		account->used + size > (Size) sqlite_max_memory_per_db * 1024)
+		return NULL;
+
+	chunk = MemoryContextAllocExtended(sqlite_mem_context, SQLITE_MEM_HEADER + size,
+									   MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM);
+	if (chunk == NULL)
+		return NULL;
+	chunk->size = size;
+	chunk->account = account;
+	if (account != NULL)
+	{
+		account->used += size;
+		account->nchunks++;
+	}
+	return (char *) chunk + SQLITE_MEM_HEADER;
+}
+
+static void *
+sqlite_mem_malloc(int size)
+{
+	return sqlite_mem_alloc(sqlite_mem_current, size);
+}
+
+static void
+sqlite_mem_free(void *ptr)
+{
+	sqlite_MemChunk *chunk = SQLITE_MEM_CHUNK(ptr);
+	sqlite_MemAccount *account = chunk->account;
+
+	if (account != NULL)
+	{
+		account->used -= chunk->size;
+		if (--account->nchunks == 0 && account->closed)
+			pfree(account);
+	}
+	pfree(chunk);
+}
+
+static int
+sqlite_mem_size(void *ptr)
+{
+	return (int) SQLITE_MEM_CHUNK(ptr)->size;
+}
+
+/* A reallocated chunk stays with the account it was allocated from */
+static void *
+sqlite_mem_realloc(void *ptr, int size)
+{
+	sqlite_MemChunk *chunk = SQLITE_MEM_CHUNK(ptr);
+	sqlite_MemAccount *account = chunk->account;
+	void *result;
+
+	/* Only what it grows by counts towards the limit */
+	if (account != NULL)
+		account->used -= chunk->size;
+	result = sqlite_mem_alloc(account, size);
+	if (account != NULL)
+		account->used += chunk->size;
+	if (result == NULL)
+		return NULL;
+	memcpy(result, ptr, Min(size, chunk->size));
+	sqlite_mem_free(ptr);
+	return result;
+}
+
+static int
+sqlite_mem_roundup(int size)
+{
+	return MAXALIGN(size);
+}
+
+static int
+sqlite_mem_init_methods(void *arg)
+{
+	return SQLITE_OK;
+}
+
+static void
+sqlite_mem_shutdown(void *arg)
+{
+}
+
+static const sqlite3_mem_methods sqlite_mem_methods = {
+	sqlite_mem_malloc,
+	sqlite_mem_free,
+	sqlite_mem_realloc,
+	sqlite_mem_size,
+	sqlite_mem_roundup,
+	sqlite_mem_init_methods,
+	sqlite_mem_shutdown,
+	NULL
+};
+
+/* Install the allocator.  This has to happen before SQLite is first
+   initialized, which registering the VFS does. */
+void
+sqlite_mem_init(void)
+{
+	LOGF();
+
+	if (sqlite_mem_context != NULL)
+		return;
+
+	sqlite_mem_context = AllocSetContextCreate(TopMemoryContext,
+											   "SQLite",
+											   ALLOCSET_DEFAULT_SIZES);
+
+	/* Another library in the backend may have initialized SQLite
+	   already, in which case it keeps allocating with malloc() */
+	if (sqlite3_config(SQLITE_CONFIG_MALLOC, &sqlite_mem_methods) != SQLITE_OK)
+		ereport(WARNING,
+				(errmsg("could not install the SQLite memory allocator"),
+				 errdetail("SQLite was initialized before the sqlite extension was loaded.")));
+}
+
+/* A new account, to be charged with the allocations of one database */
+sqlite_MemAccount *
+sqlite_mem_account_create(void)
+{
+	sqlite_MemAccount *account;
+
+	account = MemoryContextAllocZero(sqlite_mem_context, sizeof(sqlite_MemAccount));
+	return account;
+}
+
+/* Charge what SQLite allocates from now on to account */
+void
+sqlite_mem_enter(sqlite_MemAccount *account)
+{
+	sqlite_mem_current = account;
+}
+
+/* The database of account was closed.  Whatever SQLite still holds of
+   it stays charged until freed. */
+void
+sqlite_mem_account_close(sqlite_MemAccount *account)
+{
+	if (sqlite_mem_current == account)
+		sqlite_mem_current = NULL;
+	account->closed = true;
+	if (account->nchunks == 0)
+		pfree(account);
+}
+
+/* Bytes SQLite holds for the database of account */
+Size
+sqlite_mem_account_used(sqlite_MemAccount *account)
+{
+	return account->used;
+}
+
+void
+sqlite_mem_assign_soft_heap_limit(int newval, void *extra)
+{
+	sqlite3_soft_heap_limit64((sqlite3_int64) newval * 1024);
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
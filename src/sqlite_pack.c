@@ -0,0 +1,505 @@
+#include "sqlite.h"
+
+#include "common/pg_lzcompress.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Compressed page format for flat sqlites.
+
+   SQLite database files compress poorly with the TOAST compressor,
+   which sees the file as one opaque stream and gives up on values that
+   don't compress well in their first kilobyte.  Most of what makes them
+   large is unused space: pages on the freelist, the gap between the
+   cell pointers and the cell content of b-tree pages, and freeblocks
+   left behind by deleted cells.  None of that space is ever read back
+   by SQLite.
+
+   Packing drops freelist leaf pages, zeroes unused space in b-tree
+   pages and compresses each page on its own, recording where each page
+   starts in a sqlite_PackedImage.  Since pages are independent, the
+   page store can decompress them one at a time as SQLite reads them.
+   Pages that don't compress are stored as is, and a database that
+   doesn't get any smaller is stored in the raw format.
+*/
+
+int sqlite_compression = SQLITE_FORMAT_RAW;
+
+/* What packing knows about a page */
+#define SQLITE_PAGE_OTHER 0
+#define SQLITE_PAGE_FREE 1
+#define SQLITE_PAGE_BTREE 2
+
+typedef struct sqlite_PackState {
+	sqlite_PageStore *store;
+	uint32 page_size;
+	uint32 usable_size;
+	uint32 npages;
+	/* SQLITE_PAGE_* for each page, indexed by page number */
+	char *kind;
+	/* Buffer for the page being looked at */
+	unsigned char *page;
+} sqlite_PackState;
+
+/* SQLite file format integers are big endian */
+static inline uint32
+sqlite_get2(const unsigned char *p)
+{
+	return ((uint32) p[0] << 8) | p[1];
+}
+
+static inline uint32
+sqlite_get4(const unsigned char *p)
+{
+	return ((uint32) p[0] << 24) | ((uint32) p[1] << 16) | ((uint32) p[2] << 8) | p[3];
+}
+
+/* Read page pgno, numbered from 1 like SQLite does */
+static void
+sqlite_pack_read_page(sqlite_PackState *state, uint32 pgno)
+{
+	if (!sqlite_store_read(state->store, state->page, state->page_size,
+						   (int64) (pgno - 1) * state->page_size))
+		sqlite_store_read_error(state->store);
+}
+
+/* Mark the leaf pages of the freelist, whose content is never read */
+static void
+sqlite_pack_mark_free(sqlite_PackState *state, uint32 trunk)
+{
+	uint32 ntrunks;
+
+	/* The count guards against a cycle in a corrupt freelist */
+	for (ntrunks = 0; trunk != 0 && trunk <= state->npages && ntrunks < state->npages; ntrunks++)
+	{
+		uint32 nleaves;
+		uint32 i;
+
+		sqlite_pack_read_page(state, trunk);
+		nleaves = sqlite_get4(state->page + 4);
+		if (nleaves > state->usable_size / 4 - 2)
+			break;
+
+		for (i = 0; i < nleaves; i++)
+		{
+			uint32 leaf = sqlite_get4(state->page + 8 + 4 * i);
+
+			if (leaf >= 1 && leaf <= state->npages)
+				state->kind[leaf] = SQLITE_PAGE_FREE;
+		}
+		trunk = sqlite_get4(state->page);
+	}
+}
+
+/* Mark every page of the b-tree rooted at root.  Only interior pages
+   are read, their children are b-tree pages by definition. */
+static void
+sqlite_pack_mark_btree(sqlite_PackState *state, uint32 root, uint32 *stack)
+{
+	int64 depth = 0;
+
+	if (root < 1 || root > state->npages || state->kind[root] == SQLITE_PAGE_BTREE)
+		return;
+	state->kind[root] = SQLITE_PAGE_BTREE;
+	stack[depth++] = root;
+
+	/* A page is on the stack at most once, since it is marked first */
+	while (depth > 0)
+	{
+		uint32 pgno = stack[--depth];
+		uint32 hdr = pgno == 1 ? 100 : 0;
+		unsigned char *page = state->page;
+		uint32 ncells;
+		uint32 i;
+
+		CHECK_FOR_INTERRUPTS();
+
+		sqlite_pack_read_page(state, pgno);
+		if (page[hdr] != 2 && page[hdr] != 5)
+		{
+			/* A leaf, or not a b-tree page at all after all */
+			if (page[hdr] != 10 && page[hdr] != 13)
+				state->kind[pgno] = SQLITE_PAGE_OTHER;
+			continue;
+		}
+
+		ncells = sqlite_get2(page + hdr + 3);
+		if (hdr + 12 + 2 * ncells > state->usable_size)
+		{
+			state->kind[pgno] = SQLITE_PAGE_OTHER;
+			continue;
+		}
+
+		/* Each cell starts with its left child, then the right-most one */
+		for (i = 0; i <= ncells; i++)
+		{
+			uint32 child;
+
+			if (i < ncells)
+			{
+				uint32 cell = sqlite_get2(page + hdr + 12 + 2 * i);
+
+				if (cell + 4 > state->usable_size)
+					continue;
+				child = sqlite_get4(page + cell);
+			}
+			else
+				child = sqlite_get4(page + hdr + 8);
+
+			if (child >= 1 && child <= state->npages &&
+				state->kind[child] != SQLITE_PAGE_BTREE)
+			{
+				state->kind[child] = SQLITE_PAGE_BTREE;
+				stack[depth++] = child;
+			}
+		}
+	}
+}
+
+/* Mark the pages of every table and index in the database */
+static void
+sqlite_pack_mark_btrees(sqlite_PackState *state, sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	uint32 *stack;
+	int rc;
+
+	stack = palloc((state->npages + 1) * sizeof(uint32));
+
+	/* The schema table itself is rooted at page 1 */
+	sqlite_pack_mark_btree(state, 1, stack);
+
+	if (sqlite3_prepare_v2(db, "SELECT rootpage FROM main.sqlite_master WHERE rootpage > 0",
+						   -1, &stmt, NULL) != SQLITE_OK)
+	{
+		sqlite_store_check_error(state->store);
+		ereport(ERROR, (errmsg("Failed to read sqlite schema: %s", sqlite3_errmsg(db))));
+	}
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		sqlite3_int64 root = sqlite3_column_int64(stmt, 0);
+
+		if (root <= state->npages)
+			sqlite_pack_mark_btree(state, (uint32) root, stack);
+	}
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_DONE)
+	{
+		sqlite_store_check_error(state->store);
+		ereport(ERROR, (errmsg("Failed to read sqlite schema: %s", sqlite3_errmsg(db))));
+	}
+
+	pfree(stack);
+}
+
+/* Zero the unallocated space and the freeblocks of a b-tree page */
+static void
+sqlite_pack_scrub(sqlite_PackState *state, uint32 pgno)
+{
+	unsigned char *page = state->page;
+	uint32 hdr = pgno == 1 ? 100 : 0;
+	uint32 cells;
+	uint32 content;
+	uint32 freeblock;
+	uint32 n;
+
+	if (page[hdr] == 2 || page[hdr] == 5)
+		cells = hdr + 12;
+	else if (page[hdr] == 10 || page[hdr] == 13)
+		cells = hdr + 8;
+	else
+		return;
+
+	cells += 2 * sqlite_get2(page + hdr + 3);
+	content = sqlite_get2(page + hdr + 5);
+	if (content == 0)
+		content = 65536;
+	if (cells > content || content > state->usable_size)
+		return;
+
+	memset(page + cells, 0, content - cells);
+
+	/* Freeblocks keep their next pointer and size */
+	freeblock = sqlite_get2(page + hdr + 1);
+	for (n = 0; freeblock != 0 && n < state->usable_size / 4; n++)
+	{
+		uint32 size;
+
+		if (freeblock < content || freeblock + 4 > state->usable_size)
+			break;
+		size = sqlite_get2(page + freeblock + 2);
+		if (size < 4 || freeblock + size > state->usable_size)
+			break;
+		memset(page + freeblock + 4, 0, size - 4);
+		freeblock = sqlite_get2(page + freeblock);
+	}
+}
+
+static bool
+sqlite_page_is_zero(const unsigned char *page, uint32 size)
+{
+	uint32 i;
+
+	for (i = 0; i < size; i++)
+		if (page[i] != 0)
+			return false;
+	return true;
+}
+
+/* Compress a page into dest, which has room for PGLZ_MAX_OUTPUT(size)
+   bytes.  Returns the compressed size, or -1 if the page didn't get
+   smaller.  pglz is told to try the whole page: the default strategy
+   gives up on a page whose first kilobyte doesn't compress, and a full
+   b-tree page starts with its array of cell pointers, which seldom
+   does even when the cells do. */
+static int32
+sqlite_compress_page(int format, const unsigned char *page, uint32 size, unsigned char *dest)
+{
+	int32 len = -1;
+
+	switch (format)
+	{
+		case SQLITE_FORMAT_PGLZ:
+			len = pglz_compress((const char *) page, size, (char *) dest,
+								PGLZ_strategy_always);
+			break;
+#ifdef USE_LZ4
+		case SQLITE_FORMAT_LZ4:
+			len = LZ4_compress_default((const char *) page, (char *) dest, size, size - 1);
+			if (len == 0)
+				len = -1;
+			break;
+#endif
+#ifdef USE_ZSTD
+		case SQLITE_FORMAT_ZSTD:
+			{
+				size_t zlen = ZSTD_compress(dest, size - 1, page, size, ZSTD_CLEVEL_DEFAULT);
+
+				len = ZSTD_isError(zlen) ? -1 : (int32) zlen;
+			}
+			break;
+#endif
+		default:
+			elog(ERROR, "unsupported sqlite compression format %d", format);
+	}
+	if (len >= (int32) size)
+		len = -1;
+	return len;
+}
+
+/* Pack the database file of db, returning the sqlite_PackedImage
+   allocated in the object context and its size.  Returns NULL if the
+   database can't be packed or doesn't get any smaller. */
+unsigned char *
+sqlite_pack(sqlite_Sqlite *db, int format, Size *size)
+{
+	sqlite_PageStore *store = &db->store;
+	sqlite_PackState state;
+	unsigned char header[100];
+	unsigned char *result;
+	Size data_start;
+	Size capacity;
+	Size used = 0;
+	uint32 pgno;
+
+	LOGF();
+
+	if (store->size < (int64) sizeof(header))
+		return NULL;
+	if (!sqlite_store_read(store, header, sizeof(header), 0))
+		sqlite_store_read_error(store);
+	if (memcmp(header, "SQLite format 3", 16) != 0)
+		return NULL;
+
+	state.store = store;
+	state.page_size = sqlite_get2(header + 16);
+	if (state.page_size == 1)
+		state.page_size = 65536;
+	if (state.page_size < 512 || (state.page_size & (state.page_size - 1)) != 0)
+		return NULL;
+	state.usable_size = state.page_size - header[20];
+	if (state.usable_size < 480)
+		return NULL;
+	if (store->size % state.page_size != 0 ||
+		store->size / state.page_size >= PG_UINT32_MAX)
+		return NULL;
+	state.npages = store->size / state.page_size;
+
+	state.kind = palloc0(state.npages + 1);
+	state.page = palloc(state.page_size);
+
+	/* The b-trees win if a corrupt freelist claims one of their pages */
+	sqlite_pack_mark_free(&state, sqlite_get4(header + 32));
+	sqlite_pack_mark_btrees(&state, db->db);
+
+	data_start = offsetof(sqlite_PackedImage, offsets) + ((Size) state.npages + 1) * sizeof(uint32);
+	capacity = data_start + store->size / 4 + PGLZ_MAX_OUTPUT(state.page_size);
+	result = MemoryContextAllocHuge(db->hdr.eoh_context, capacity);
+
+	for (pgno = 1; pgno <= state.npages; pgno++)
+	{
+		int32 len;
+
+		CHECK_FOR_INTERRUPTS();
+
+		((sqlite_PackedImage *) result)->offsets[pgno - 1] = used;
+		if (state.kind[pgno] == SQLITE_PAGE_FREE)
+			continue;
+
+		sqlite_pack_read_page(&state, pgno);
+		if (state.kind[pgno] == SQLITE_PAGE_BTREE)
+			sqlite_pack_scrub(&state, pgno);
+		if (sqlite_page_is_zero(state.page, state.page_size))
+			continue;
+
+		if (data_start + used + PGLZ_MAX_OUTPUT(state.page_size) > capacity)
+		{
+			capacity *= 2;
+			result = repalloc_huge(result, capacity);
+		}
+
+		len = sqlite_compress_page(format, state.page, state.page_size,
+								   result + data_start + used);
+		if (len < 0)
+		{
+			memcpy(result + data_start + used, state.page, state.page_size);
+			len = state.page_size;
+		}
+		used += len;
+
+		/* Not worth it, or too large to store anyway */
+		if (data_start + used >= (Size) store->size || data_start + used > MaxAllocSize)
+		{
+			pfree(result);
+			result = NULL;
+			break;
+		}
+	}
+
+	pfree(state.kind);
+	pfree(state.page);
+
+	if (result == NULL)
+		return NULL;
+
+	((sqlite_PackedImage *) result)->page_size = state.page_size;
+	((sqlite_PackedImage *) result)->npages = state.npages;
+	((sqlite_PackedImage *) result)->offsets[state.npages] = used;
+	*size = data_start + used;
+	return result;
+}
+
+/* Decompress page pgno, numbered from 0, of a packed image.  Returns
+   false if the page is corrupt, since this runs inside SQLite. */
+bool
+sqlite_unpack_page(const sqlite_PackedImage *packed, int format, int64 pgno, unsigned char *page)
+{
+	const unsigned char *data = SQLITE_PACKED_DATA(packed) + packed->offsets[pgno];
+	int32 len = packed->offsets[pgno + 1] - packed->offsets[pgno];
+	int32 page_size = packed->page_size;
+
+	if (len == 0)
+	{
+		memset(page, 0, page_size);
+		return true;
+	}
+	if (len == page_size)
+	{
+		memcpy(page, data, page_size);
+		return true;
+	}
+
+	switch (format)
+	{
+		case SQLITE_FORMAT_PGLZ:
+			return pglz_decompress((const char *) data, len, (char *) page,
+								   page_size, true) == page_size;
+#ifdef USE_LZ4
+		case SQLITE_FORMAT_LZ4:
+			return LZ4_decompress_safe((const char *) data, (char *) page,
+									   len, page_size) == page_size;
+#endif
+#ifdef USE_ZSTD
+		case SQLITE_FORMAT_ZSTD:
+			return ZSTD_decompress(page, page_size, data, len) == (size_t) page_size;
+#endif
+		default:
+			return false;
+	}
+}
+
+/* Back the store with a packed image, after checking that its page
+   index is consistent so reads never go out of bounds. */
+void
+sqlite_store_set_packed(sqlite_PageStore *store, int format, const unsigned char *data, Size size)
+{
+	const sqlite_PackedImage *packed = (const sqlite_PackedImage *) data;
+	Size data_start;
+	uint32 i;
+
+	switch (format)
+	{
+		case SQLITE_FORMAT_PGLZ:
+			break;
+		case SQLITE_FORMAT_LZ4:
+#ifndef USE_LZ4
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("sqlite database is compressed with lz4, which is not supported by this build")));
+#endif
+			break;
+		case SQLITE_FORMAT_ZSTD:
+#ifndef USE_ZSTD
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("sqlite database is compressed with zstd, which is not supported by this build")));
+#endif
+			break;
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("unrecognized sqlite storage format %d", format)));
+	}
+
+	if (size < offsetof(sqlite_PackedImage, offsets) ||
+		packed->page_size < 512 || packed->page_size > 65536 ||
+		(packed->page_size & (packed->page_size - 1)) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid packed sqlite database header")));
+
+	data_start = offsetof(sqlite_PackedImage, offsets) + ((Size) packed->npages + 1) * sizeof(uint32);
+	if (data_start > size || packed->offsets[0] != 0 ||
+		packed->offsets[packed->npages] != size - data_start)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid packed sqlite database page index")));
+
+	for (i = 0; i < packed->npages; i++)
+	{
+		if (packed->offsets[i + 1] < packed->offsets[i] ||
+			packed->offsets[i + 1] - packed->offsets[i] > packed->page_size)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid packed sqlite database page index")));
+	}
+
+	store->packed = packed;
+	store->format = format;
+	store->unpacked = MemoryContextAlloc(store->cxt, packed->page_size);
+	store->unpacked_pgno = -1;
+	store->image = NULL;
+	store->image_size = (Size) packed->npages * packed->page_size;
+	store->size = store->image_size;
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
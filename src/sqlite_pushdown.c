@@ -0,0 +1,436 @@
+#include "sqlite.h"
+
+#include "access/stratnum.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_opfamily.h"
+#include "catalog/pg_type.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
+#include "utils/float.h"
+#include "utils/typcache.h"
+
+/* Pushdown of quals, ORDER BY and LIMIT into sqlite_query().
+
+   A query like
+
+     SELECT * FROM sqlite_query(db, 'SELECT * FROM events') AS t(id int, ts int)
+     WHERE t.ts > 1700000000 ORDER BY t.ts LIMIT 10
+
+   is planned with the SQLite query rewritten to
+
+     WITH sqlite_pushdown(c1, c2) AS (
+     SELECT * FROM events
+     ) SELECT * FROM sqlite_pushdown WHERE c2 > 1700000000 ORDER BY c2 ASC NULLS LAST LIMIT 10
+
+   which SQLite flattens, so it can use the indexes of the database and
+   rows that don't qualify are never converted.  The function scan runs
+   as before and Postgres still checks the quals and sorts the rows.  A
+   row SQLite drops would be dropped by Postgres as well, unless its
+   value could not be converted to the declared type, which is then no
+   longer an error.
+
+   Only comparisons of a column with a constant are pushed, and only
+   where SQLite compares the same way Postgres does: integer and double
+   columns, and text columns for equality under a deterministic
+   collation or any comparison under the C collation.  A text column
+   gets whatever affinity and collation the query gives it, so it is
+   compared and sorted as CAST(cN AS TEXT) COLLATE BINARY, the text
+   Postgres converts the value to.  The parameters of a generic plan are
+   only known when it runs and are not pushed, custom plans see them as
+   constants.  ORDER BY and LIMIT are pushed when the function is the
+   only relation of the query and every qual and sort key could be
+   pushed.
+
+   Only single SELECT or VALUES statements are rewritten, they are the
+   only ones that can go in a CTE.
+*/
+
+bool sqlite_enable_pushdown = true;
+
+static set_rel_pathlist_hook_type prev_set_rel_pathlist_hook = NULL;
+
+/* SQLite operators by btree strategy number */
+static const char *const sqlite_pushdown_operators[] = {
+	NULL, "<", "<=", "=", ">=", ">"
+};
+
+/* The length of query without trailing semicolons and whitespace, or -1
+   if it isn't a single statement that can be wrapped in a CTE. */
+static int
+sqlite_pushdown_query_len(const char *query)
+{
+	const char *p = query;
+	int len = strlen(query);
+
+	while (len > 0 && (isspace((unsigned char) query[len - 1]) || query[len - 1] == ';'))
+		len--;
+	if (memchr(query, ';', len) != NULL)
+		return -1;
+
+	while (isspace((unsigned char) *p) || *p == '(')
+		p++;
+	if (pg_strncasecmp(p, "SELECT", 6) != 0 && pg_strncasecmp(p, "VALUES", 6) != 0)
+		return -1;
+	return len;
+}
+
+/* The column of the rewritten query node refers to, if it is one of
+   a type SQLite compares and sorts like Postgres */
+static Var *
+sqlite_pushdown_column(Node *node, Index rti, int ncols)
+{
+	Var *var;
+
+	while (IsA(node, RelabelType))
+		node = (Node *) ((RelabelType *) node)->arg;
+	if (!IsA(node, Var))
+		return NULL;
+
+	var = (Var *) node;
+	if (var->varno != rti || var->varlevelsup != 0 ||
+		var->varattno <= 0 || var->varattno > ncols)
+		return NULL;
+
+	switch (var->vartype)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case TEXTOID:
+		case VARCHAROID:
+			return var;
+		default:
+			return NULL;
+	}
+}
+
+/* Append var as an operand of the rewritten query.  Text is compared as
+   the text Postgres converts the value to, bytewise. */
+static void
+sqlite_pushdown_append_column(StringInfo buf, Var *var)
+{
+	if (var->vartype == TEXTOID || var->vartype == VARCHAROID)
+		appendStringInfo(buf, "CAST(c%d AS TEXT) COLLATE BINARY", var->varattno);
+	else
+		appendStringInfo(buf, "c%d", var->varattno);
+}
+
+/* Append the value of c as a SQLite literal, if it has one */
+static bool
+sqlite_pushdown_literal(StringInfo buf, Const *c)
+{
+	if (c->constisnull)
+		return false;
+
+	switch (c->consttype)
+	{
+		case INT2OID:
+			appendStringInfo(buf, "%d", DatumGetInt16(c->constvalue));
+			break;
+		case INT4OID:
+			appendStringInfo(buf, "%d", DatumGetInt32(c->constvalue));
+			break;
+		case INT8OID:
+			appendStringInfo(buf, INT64_FORMAT, DatumGetInt64(c->constvalue));
+			break;
+		case FLOAT4OID:
+		case FLOAT8OID:
+			{
+				double value = c->consttype == FLOAT4OID ?
+					DatumGetFloat4(c->constvalue) : DatumGetFloat8(c->constvalue);
+
+				/* SQLite has no NaN, it turns one into NULL */
+				if (isnan(value))
+					return false;
+				if (isinf(value))
+					appendStringInfoString(buf, value > 0 ? "9e999" : "-9e999");
+				else
+					appendStringInfo(buf, "%.17g", value);
+			}
+			break;
+		case TEXTOID:
+		case VARCHAROID:
+			{
+				char *str = TextDatumGetCString(c->constvalue);
+				char *p;
+
+				appendStringInfoChar(buf, '\'');
+				for (p = str; *p; p++)
+				{
+					if (*p == '\'')
+						appendStringInfoChar(buf, '\'');
+					appendStringInfoChar(buf, *p);
+				}
+				appendStringInfoChar(buf, '\'');
+				pfree(str);
+			}
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+/* Append clause as a condition of the rewritten query, if it compares
+   a column with a constant the way SQLite would */
+static bool
+sqlite_pushdown_qual(StringInfo buf, Expr *clause, Index rti, int ncols)
+{
+	OpExpr *op;
+	Node *left;
+	Node *right;
+	Var *var;
+	Node *value;
+	Oid opno;
+	Oid opfamily;
+	Oid negator;
+	int strategy;
+	bool negated = false;
+
+	if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2)
+		return false;
+
+	op = (OpExpr *) clause;
+	opno = op->opno;
+	left = linitial(op->args);
+	right = lsecond(op->args);
+
+	if ((var = sqlite_pushdown_column(left, rti, ncols)) != NULL)
+		value = right;
+	else if ((var = sqlite_pushdown_column(right, rti, ncols)) != NULL)
+	{
+		value = left;
+		opno = get_commutator(opno);
+		if (!OidIsValid(opno))
+			return false;
+	}
+	else
+		return false;
+
+	/* SQLite compares the double a real is stored as, Postgres the
+	   float4 it converts it to */
+	if (var->vartype == FLOAT4OID)
+		return false;
+
+	while (IsA(value, RelabelType))
+		value = (Node *) ((RelabelType *) value)->arg;
+	if (!IsA(value, Const))
+		return false;
+
+	/* The column's type is one SQLite compares alike, the operator has
+	   to be of its default btree family to compare the same way */
+	opfamily = lookup_type_cache(var->vartype, TYPECACHE_BTREE_OPFAMILY)->btree_opf;
+	if (!OidIsValid(opfamily))
+		return false;
+
+	strategy = get_op_opfamily_strategy(opno, opfamily);
+	if (strategy == 0)
+	{
+		/* <> is no btree operator, but the negator of one */
+		negator = get_negator(opno);
+		if (!OidIsValid(negator) ||
+			get_op_opfamily_strategy(negator, opfamily) != BTEqualStrategyNumber)
+			return false;
+		strategy = BTEqualStrategyNumber;
+		negated = true;
+	}
+
+	/* SQLite compares text bytewise, like the C collation */
+	if (opfamily == TEXT_BTREE_FAM_OID)
+	{
+		if (strategy == BTEqualStrategyNumber ?
+			!OidIsValid(op->inputcollid) || !get_collation_isdeterministic(op->inputcollid) :
+			op->inputcollid != C_COLLATION_OID)
+			return false;
+	}
+
+	sqlite_pushdown_append_column(buf, var);
+	appendStringInfo(buf, " %s ", negated ? "<>" : sqlite_pushdown_operators[strategy]);
+	return sqlite_pushdown_literal(buf, (Const *) value);
+}
+
+/* Append the ORDER BY of the query, if SQLite sorts every key of it the
+   same way */
+static bool
+sqlite_pushdown_sort(StringInfo buf, Query *parse, Index rti, int ncols)
+{
+	const char *sep = " ORDER BY ";
+	ListCell *lc;
+
+	/* NULLS FIRST and NULLS LAST need SQLite 3.30 */
+	if (sqlite3_libversion_number() < 3030000)
+		return false;
+
+	foreach(lc, parse->sortClause)
+	{
+		SortGroupClause *sortcl = lfirst_node(SortGroupClause, lc);
+		TargetEntry *tle = get_sortgroupclause_tle(sortcl, parse->targetList);
+		Var *var = sqlite_pushdown_column((Node *) tle->expr, rti, ncols);
+		TypeCacheEntry *typentry;
+		bool desc;
+
+		if (var == NULL)
+			return false;
+
+		typentry = lookup_type_cache(exprType((Node *) tle->expr),
+									 TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+		if (sortcl->sortop == typentry->lt_opr)
+			desc = false;
+		else if (sortcl->sortop == typentry->gt_opr)
+			desc = true;
+		else
+			return false;
+
+		if ((var->vartype == TEXTOID || var->vartype == VARCHAROID) &&
+			exprCollation((Node *) tle->expr) != C_COLLATION_OID)
+			return false;
+
+		appendStringInfoString(buf, sep);
+		sqlite_pushdown_append_column(buf, var);
+		appendStringInfo(buf, " %s NULLS %s",
+						 desc ? "DESC" : "ASC", sortcl->nulls_first ? "FIRST" : "LAST");
+		sep = ", ";
+	}
+	return true;
+}
+
+/* Whether call is of sqlite_query() */
+static bool
+sqlite_pushdown_is_query(FuncExpr *call)
+{
+	FmgrInfo flinfo;
+
+	if (call->funcresulttype != RECORDOID || list_length(call->args) < 2)
+		return false;
+	fmgr_info(call->funcid, &flinfo);
+	return flinfo.fn_addr == sqlite_query;
+}
+
+static void
+sqlite_pushdown(PlannerInfo *root, RelOptInfo *rel, Index rti, RangeTblEntry *rte)
+{
+	RangeTblFunction *rtfunc;
+	FuncExpr *call;
+	Const *query;
+	StringInfoData buf;
+	const char *sep = " WHERE ";
+	char *sql;
+	bool all_pushed = true;
+	int npushed = 0;
+	int ncols;
+	int len;
+	int i;
+	ListCell *lc;
+
+	if (list_length(rte->functions) != 1 || rte->funcordinality)
+		return;
+	rtfunc = linitial_node(RangeTblFunction, rte->functions);
+	if (!IsA(rtfunc->funcexpr, FuncExpr) ||
+		!sqlite_pushdown_is_query((FuncExpr *) rtfunc->funcexpr))
+		return;
+
+	call = (FuncExpr *) rtfunc->funcexpr;
+	query = (Const *) lsecond(call->args);
+	if (!IsA(query, Const) || query->constisnull)
+		return;
+	sql = TextDatumGetCString(query->constvalue);
+	len = sqlite_pushdown_query_len(sql);
+	if (len < 0)
+		return;
+
+	LOGF();
+
+	/* Columns are renamed by position, the query's own names may not
+	   even be unique */
+	ncols = rtfunc->funccolcount;
+	initStringInfo(&buf);
+	appendStringInfoString(&buf, "WITH sqlite_pushdown(");
+	for (i = 1; i <= ncols; i++)
+		appendStringInfo(&buf, "%sc%d", i > 1 ? ", " : "", i);
+	/* On lines of its own, the query may end in a -- comment */
+	appendStringInfo(&buf, ") AS (\n%.*s\n) SELECT * FROM sqlite_pushdown", len, sql);
+
+	foreach(lc, rel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+		int mark = buf.len;
+
+		/* Quals on no column gate the whole scan */
+		if (rinfo->pseudoconstant)
+			continue;
+
+		appendStringInfoString(&buf, sep);
+		if (sqlite_pushdown_qual(&buf, rinfo->clause, rti, ncols))
+		{
+			sep = " AND ";
+			npushed++;
+		}
+		else
+		{
+			buf.len = mark;
+			buf.data[mark] = '\0';
+			all_pushed = false;
+		}
+	}
+
+	/* A LIMIT applies to the rows of the function only when there is no
+	   other relation, and only after all quals and the sort */
+	if (all_pushed && root->limit_tuples > 0 &&
+		root->parse->limitOption == LIMIT_OPTION_COUNT &&
+		bms_membership(root->all_baserels) == BMS_SINGLETON)
+	{
+		int mark = buf.len;
+
+		if (sqlite_pushdown_sort(&buf, root->parse, rti, ncols))
+		{
+			appendStringInfo(&buf, " LIMIT %.0f", ceil(root->limit_tuples));
+			npushed++;
+		}
+		else
+		{
+			buf.len = mark;
+			buf.data[mark] = '\0';
+		}
+	}
+
+	if (npushed == 0)
+	{
+		pfree(buf.data);
+		return;
+	}
+
+	/* The function scan is planned from the expression in the range
+	   table, which is the planner's own copy */
+	call = copyObject(call);
+	lfirst(list_nth_cell(call->args, 1)) = makeConst(TEXTOID, -1, query->constcollid, -1,
+												 CStringGetTextDatum(buf.data), false, false);
+	rtfunc->funcexpr = (Node *) call;
+}
+
+static void
+sqlite_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti, RangeTblEntry *rte)
+{
+	if (prev_set_rel_pathlist_hook)
+		prev_set_rel_pathlist_hook(root, rel, rti, rte);
+
+	if (sqlite_enable_pushdown && rte->rtekind == RTE_FUNCTION)
+		sqlite_pushdown(root, rel, rti, rte);
+}
+
+void
+sqlite_pushdown_init(void)
+{
+	LOGF();
+
+	prev_set_rel_pathlist_hook = set_rel_pathlist_hook;
+	set_rel_pathlist_hook = sqlite_set_rel_pathlist;
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -1,39 +1,152 @@
 #include "sqlite.h"
 
+#include "miscadmin.h"
+#include "utils/memutils.h"
+
 PG_FUNCTION_INFO_V1(sqlite_query);
 
 typedef struct {
-    sqlite3 *db;
+    sqlite_Sqlite *sqlite;
     sqlite3_stmt *stmt;
+    sqlite_Converter *converters;
+    Datum *values;
+    bool *nulls;
 } SqliteQueryState;
 
+/* Hand the statement back to the cache, called when the scan finishes
+   or is shut down early (for example by a LIMIT). */
+static void
+sqlite_query_release(Datum arg)
+{
+    SqliteQueryState *query_state = (SqliteQueryState *) DatumGetPointer(arg);
+
+    if (query_state->stmt != NULL)
+    {
+        sqlite_release_stmt(query_state->sqlite, query_state->stmt);
+        query_state->stmt = NULL;
+    }
+}
+
+/* Materialize mode: step the statement to completion in one call and
+   put every row into a tuplestore.  The executor can rescan the
+   tuplestore instead of calling us again, for example when the
+   function is on the inner side of a nested loop. */
+static void
+sqlite_query_materialize(FunctionCallInfo fcinfo, sqlite_Sqlite *sqlite, sqlite3_stmt *stmt,
+                         sqlite_BindArgs *args)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    MemoryContext rowcontext;
+    MemoryContext oldcontext;
+    sqlite_Converter *converters;
+    Datum *values;
+    bool *nulls;
+    int natts;
+    int rc;
+
+    InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+
+    natts = rsinfo->setDesc->natts;
+    values = palloc(natts * sizeof(Datum));
+    nulls = palloc(natts * sizeof(bool));
+
+    /* Row values only live until they are copied into the tuplestore */
+    rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+                                       "sqlite_query row",
+                                       ALLOCSET_SMALL_SIZES);
+
+    PG_TRY();
+    {
+        sqlite_bind_args(sqlite, stmt, args);
+        converters = sqlite_get_converters(stmt, rsinfo->setDesc);
+
+        while ((rc = sqlite_step(stmt)) == SQLITE_ROW)
+        {
+            CHECK_FOR_INTERRUPTS();
+
+            oldcontext = MemoryContextSwitchTo(rowcontext);
+            sqlite_convert_row(stmt, converters, natts, values, nulls);
+            MemoryContextSwitchTo(oldcontext);
+
+            tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+            MemoryContextReset(rowcontext);
+        }
+        if (rc != SQLITE_DONE)
+        {
+            sqlite_store_check_error(&sqlite->store);
+            ereport(ERROR, (errmsg("Failed to execute SQLite query: %s", sqlite3_errmsg(sqlite->db))));
+        }
+    }
+    PG_FINALLY();
+    {
+        sqlite_release_stmt(sqlite, stmt);
+    }
+    PG_END_TRY();
+
+    MemoryContextDelete(rowcontext);
+}
+
 Datum
 sqlite_query(PG_FUNCTION_ARGS) {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
     FuncCallContext *funcctx;
     SqliteQueryState *query_state;
     const char *query;
     TupleDesc tupdesc;
     HeapTuple tuple;
-    int column_count;
-    int column_type;
+    int rc;
 
     LOGF();
 
+    /* Prefer materialize mode whenever the caller accepts it */
+    if (rsinfo != NULL && IsA(rsinfo, ReturnSetInfo) &&
+        (rsinfo->allowedModes & SFRM_Materialize) != 0)
+    {
+        sqlite_Sqlite *sqlite;
+        sqlite3_stmt *stmt;
+        sqlite_BindArgs args;
+
+        /* The variadic variant binding parameters isn't strict */
+        if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+        {
+            InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+            return (Datum) 0;
+        }
+
+        sqlite = SQLITE_GETARG_RO(0);
+        query = text_to_cstring(PG_GETARG_TEXT_PP(1));
+        sqlite_get_bind_args(fcinfo, 2, &args);
+        stmt = sqlite_prepare_cached(sqlite, query, NULL);
+        if (stmt == NULL)
+        {
+            InitMaterializedSRF(fcinfo, MAT_SRF_USE_EXPECTED_DESC);
+            return (Datum) 0;
+        }
+        sqlite_query_materialize(fcinfo, sqlite, stmt, &args);
+        return (Datum) 0;
+    }
+
     if (SRF_IS_FIRSTCALL()) {
         MemoryContext oldcontext;
+        sqlite_BindArgs args;
         funcctx = SRF_FIRSTCALL_INIT();
 
+        if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+            SRF_RETURN_DONE(funcctx);
+
         oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
         query_state = (SqliteQueryState *) palloc(sizeof(SqliteQueryState));
 
-        query_state->db = SQLITE_GETARG(0)->db;
+        query_state->sqlite = SQLITE_GETARG_RO(0);
         query = text_to_cstring(PG_GETARG_TEXT_PP(1));
 
-        if (sqlite3_prepare_v2(query_state->db, query, -1, &query_state->stmt, NULL) != SQLITE_OK)
-            ereport(ERROR, (errmsg("Failed to prepare SQLite query: %s", sqlite3_errmsg(query_state->db))));
+        sqlite_get_bind_args(fcinfo, 2, &args);
+        query_state->stmt = sqlite_prepare_cached(query_state->sqlite, query, NULL);
 
         funcctx->user_fctx = query_state;
-        column_count = sqlite3_column_count(query_state->stmt);
+        RegisterExprContextCallback(rsinfo->econtext,
+                                    sqlite_query_release,
+                                    PointerGetDatum(query_state));
 
 		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
 			ereport(ERROR,
@@ -43,39 +156,39 @@ sqlite_query(PG_FUNCTION_ARGS) {
 
         BlessTupleDesc(tupdesc);
         funcctx->tuple_desc = tupdesc;
+
+        /* Converters are chosen once from the declared column types */
+        query_state->converters = sqlite_get_converters(query_state->stmt, tupdesc);
+        if (query_state->stmt != NULL)
+            sqlite_bind_args(query_state->sqlite, query_state->stmt, &args);
+
+        /* Value buffers are reused for every row */
+        query_state->values = palloc(tupdesc->natts * sizeof(Datum));
+        query_state->nulls = palloc(tupdesc->natts * sizeof(bool));
         MemoryContextSwitchTo(oldcontext);
     }
 
     funcctx = SRF_PERCALL_SETUP();
     query_state = (SqliteQueryState *) funcctx->user_fctx;
-    column_count = sqlite3_column_count(query_state->stmt);
-
-    if (sqlite3_step(query_state->stmt) == SQLITE_ROW) {
-        Datum *values = palloc0(column_count * sizeof(Datum));
-        bool *nulls = palloc0(column_count * sizeof(bool));
-
-        for (int i = 0; i < column_count; i++) {
-            column_type = sqlite3_column_type(query_state->stmt, i);
-            switch (column_type) {
-                case SQLITE_INTEGER:
-                    values[i] = Int32GetDatum(sqlite3_column_int(query_state->stmt, i));
-                    break;
-                case SQLITE_FLOAT:
-                    values[i] = Float8GetDatum(sqlite3_column_double(query_state->stmt, i));
-                    break;
-                case SQLITE_TEXT:
-                    values[i] = CStringGetTextDatum((const char *) sqlite3_column_text(query_state->stmt, i));
-                    break;
-                default:
-                    nulls[i] = true;
-                    break;
-            }
-        }
+
+    rc = query_state->stmt != NULL ? sqlite_step(query_state->stmt) : SQLITE_DONE;
+    if (rc == SQLITE_ROW) {
         tupdesc = funcctx->tuple_desc;
-        tuple = heap_form_tuple(tupdesc, values, nulls);
+        sqlite_convert_row(query_state->stmt, query_state->converters, tupdesc->natts,
+                           query_state->values, query_state->nulls);
+        tuple = heap_form_tuple(tupdesc, query_state->values, query_state->nulls);
         SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
     } else {
-        sqlite3_finalize(query_state->stmt);
+        /* The error message goes with the statement handed back */
+        char *msg = rc != SQLITE_DONE ? pstrdup(sqlite3_errmsg(query_state->sqlite->db)) : NULL;
+
+        UnregisterExprContextCallback(rsinfo->econtext,
+                                      sqlite_query_release,
+                                      PointerGetDatum(query_state));
+        sqlite_query_release(PointerGetDatum(query_state));
+        sqlite_store_check_error(&query_state->sqlite->store);
+        if (rc != SQLITE_DONE)
+            ereport(ERROR, (errmsg("Failed to execute SQLite query: %s", msg)));
         SRF_RETURN_DONE(funcctx);
     }
 }
@@ -0,0 +1,179 @@
+#include "sqlite.h"
+
+#include "miscadmin.h"
+#include "utils/array.h"
+#include "utils/memutils.h"
+
+PG_FUNCTION_INFO_V1(sqlite_query_columns);
+
+/* The result of a query as one array per column.
+
+   The result is a single row with a column for each result column of
+   the query, declared as an array of the type to convert its values
+   to.  Values are converted as by sqlite_query() and go straight into
+   a buffer per column while the statement is stepped, so no tuple is
+   ever formed for a row, and each array is built from its buffer once
+   the statement is done.
+*/
+
+typedef struct sqlite_ColumnBuffer {
+	Oid elemtype;
+	int16 elemlen;
+	bool elembyval;
+	char elemalign;
+	Datum *values;
+	bool *nulls;
+	bool hasnulls;
+} sqlite_ColumnBuffer;
+
+Datum
+sqlite_query_columns(PG_FUNCTION_ARGS)
+{
+	sqlite_Sqlite *sqlite;
+	sqlite3_stmt *stmt;
+	sqlite_BindArgs args;
+	sqlite_Converter *converters;
+	sqlite_ColumnBuffer *columns;
+	TupleDesc tupdesc;
+	TupleDesc elemdesc;
+	MemoryContext valuecontext;
+	MemoryContext oldcontext;
+	Datum *result;
+	bool *resultnulls;
+	int natts;
+	int nrows = 0;
+	int maxrows = 64;
+	int rc;
+	int i;
+
+	LOGF();
+
+	/* The variadic variant binding parameters isn't strict */
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	tupdesc = BlessTupleDesc(tupdesc);
+	natts = tupdesc->natts;
+
+	/* Values are converted to the element types of the columns */
+	elemdesc = CreateTemplateTupleDesc(natts);
+	columns = palloc0(natts * sizeof(sqlite_ColumnBuffer));
+	for (i = 0; i < natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+		sqlite_ColumnBuffer *column = &columns[i];
+
+		column->elemtype = get_element_type(att->atttypid);
+		if (!OidIsValid(column->elemtype))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATATYPE_MISMATCH),
+					 errmsg("column \"%s\" of the result of sqlite_query_columns() must be an array",
+							NameStr(att->attname))));
+		get_typlenbyvalalign(column->elemtype, &column->elemlen, &column->elembyval,
+							 &column->elemalign);
+		TupleDescInitEntry(elemdesc, i + 1, NameStr(att->attname), column->elemtype,
+						   att->atttypmod, 0);
+		column->values = palloc(maxrows * sizeof(Datum));
+		column->nulls = palloc(maxrows * sizeof(bool));
+	}
+
+	sqlite = SQLITE_GETARG_RO(0);
+	sqlite_get_bind_args(fcinfo, 2, &args);
+	stmt = sqlite_prepare_cached(sqlite, text_to_cstring(PG_GETARG_TEXT_PP(1)), NULL);
+
+	/* Converted values only live until they are copied into the arrays */
+	valuecontext = AllocSetContextCreate(CurrentMemoryContext,
+										 "sqlite_query_columns values",
+										 ALLOCSET_DEFAULT_SIZES);
+
+	if (stmt != NULL)
+	{
+		PG_TRY();
+		{
+			sqlite_bind_args(sqlite, stmt, &args);
+			converters = sqlite_get_converters(stmt, elemdesc);
+
+			oldcontext = MemoryContextSwitchTo(valuecontext);
+			while ((rc = sqlite_step(stmt)) == SQLITE_ROW)
+			{
+				CHECK_FOR_INTERRUPTS();
+
+				if (nrows == maxrows)
+				{
+					if (maxrows >= MaxArraySize)
+						ereport(ERROR,
+								(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+								 errmsg("SQLite query returns more rows than an array can hold")));
+					maxrows = Min(maxrows * 2, MaxArraySize);
+					for (i = 0; i < natts; i++)
+					{
+						columns[i].values = repalloc(columns[i].values, maxrows * sizeof(Datum));
+						columns[i].nulls = repalloc(columns[i].nulls, maxrows * sizeof(bool));
+					}
+				}
+
+				for (i = 0; i < natts; i++)
+				{
+					sqlite_ColumnBuffer *column = &columns[i];
+					int type = sqlite3_column_type(stmt, i);
+
+					if (type == SQLITE_NULL)
+					{
+						column->values[nrows] = (Datum) 0;
+						column->nulls[nrows] = true;
+						column->hasnulls = true;
+					}
+					else
+					{
+						column->values[nrows] = converters[i].convert(stmt, i, type, &converters[i]);
+						column->nulls[nrows] = false;
+					}
+				}
+				nrows++;
+			}
+			MemoryContextSwitchTo(oldcontext);
+
+			if (rc != SQLITE_DONE)
+			{
+				sqlite_store_check_error(&sqlite->store);
+				ereport(ERROR, (errmsg("Failed to execute SQLite query: %s", sqlite3_errmsg(sqlite->db))));
+			}
+		}
+		PG_FINALLY();
+		{
+			sqlite_release_stmt(sqlite, stmt);
+		}
+		PG_END_TRY();
+	}
+
+	result = palloc(natts * sizeof(Datum));
+	resultnulls = palloc0(natts * sizeof(bool));
+	for (i = 0; i < natts; i++)
+	{
+		sqlite_ColumnBuffer *column = &columns[i];
+		int dims[1] = {nrows};
+		int lbs[1] = {1};
+
+		if (nrows == 0)
+			result[i] = PointerGetDatum(construct_empty_array(column->elemtype));
+		else
+			result[i] = PointerGetDatum(construct_md_array(column->values,
+														   column->hasnulls ? column->nulls : NULL,
+														   1, dims, lbs, column->elemtype,
+														   column->elemlen, column->elembyval,
+														   column->elemalign));
+	}
+	MemoryContextDelete(valuecontext);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, result, resultnulls)));
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
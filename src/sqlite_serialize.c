@@ -1,28 +1,52 @@
 #include "sqlite.h"
 
+#include "utils/memutils.h"
+
 PG_FUNCTION_INFO_V1(sqlite_serialize);
+PG_FUNCTION_INFO_V1(sqlite_send);
+
+/* Return the database file image of sqlite as a bytea */
+bytea *
+sqlite_serialize_image(sqlite_Sqlite *sqlite)
+{
+	int64 size;
+	bytea *result;
+
+	LOGF();
+
+	/* Read the pages straight into the result, like flattening does,
+	   instead of going through a sqlite3_serialize() copy. */
+	size = sqlite->store.size;
+	if ((Size) size + VARHDRSZ > MaxAllocSize)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("sqlite database is too large to serialize")));
+
+	result = (bytea *) palloc(size + VARHDRSZ);
+	SET_VARSIZE(result, size + VARHDRSZ);
+	if (!sqlite_store_read(&sqlite->store, (unsigned char *) VARDATA(result), size, 0))
+		sqlite_store_read_error(&sqlite->store);
+	return result;
+}
 
 Datum
 sqlite_serialize(PG_FUNCTION_ARGS)
 {
-	sqlite_Sqlite *sqlite;
-	void *data;
-	sqlite3_int64 size;
-	bytea *result;
+	LOGF();
 
-	sqlite = SQLITE_GETARG(0);
+	PG_RETURN_BYTEA_P(sqlite_serialize_image(SQLITE_GETARG_RO(0)));
+}
 
-	data = sqlite3_serialize(sqlite->db, "main", &size, 0);
-	if (data == NULL)
-	{
-		ereport(ERROR, (errmsg("Failed to serialize sqlite db %s", sqlite3_errmsg(sqlite->db))));
-	}
-	result = (bytea *)palloc(size + VARHDRSZ);
-    SET_VARSIZE(result, size + VARHDRSZ);
-    memcpy(VARDATA(result), data, size);
-    sqlite3_free(data);
-    PG_RETURN_BYTEA_P(result);
+/* Binary output is the database file image, the same as
+   sqlite_serialize() returns.  A bytea is already the form a send
+   function returns, so no further copy through a StringInfo is
+   needed. */
+Datum
+sqlite_send(PG_FUNCTION_ARGS)
+{
+	LOGF();
 
+	PG_RETURN_BYTEA_P(sqlite_serialize_image(SQLITE_GETARG_RO(0)));
 }
 
 /* Local Variables: */
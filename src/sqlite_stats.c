@@ -0,0 +1,252 @@
+#include "sqlite.h"
+
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/timestamp.h"
+
+/* Statistics on the work done by the extension, shared by all backends.
+
+   The counters live in shared memory, so the extension has to be in
+   shared_preload_libraries for them to be collected.  Steps are counted
+   for every row, too often for each one to add to atomics that every
+   backend writes, so a backend counts in its own memory and adds its
+   counts to the shared counters at the end of each transaction.  The
+   time of events is only measured with sqlite.track_timing on, reading
+   the clock twice a row can cost more than the step itself.
+*/
+
+/* Names of the counted events, in sqlite_StatKind order */
+static const char *const sqlite_stat_names[] = {
+	"expansions", "deserializations", "flattenings", "dumps",
+	"statements_prepared", "statement_steps"
+};
+
+typedef struct sqlite_StatCounter {
+	pg_atomic_uint64 calls;
+	pg_atomic_uint64 bytes;
+	/* Nanoseconds */
+	pg_atomic_uint64 time;
+} sqlite_StatCounter;
+
+typedef struct sqlite_SharedStats {
+	sqlite_StatCounter counters[SQLITE_STAT_NUM_KINDS];
+	pg_atomic_uint64 stats_reset;
+} sqlite_SharedStats;
+
+static sqlite_SharedStats *sqlite_stats = NULL;
+
+/* Counts of this backend not yet added to the shared counters */
+typedef struct sqlite_LocalCounter {
+	uint64 calls;
+	uint64 bytes;
+	uint64 time;
+} sqlite_LocalCounter;
+
+static sqlite_LocalCounter sqlite_pending[SQLITE_STAT_NUM_KINDS];
+static bool sqlite_have_pending = false;
+
+bool sqlite_track_timing = false;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+PG_FUNCTION_INFO_V1(pg_stat_sqlite);
+PG_FUNCTION_INFO_V1(pg_stat_sqlite_reset);
+
+static void
+sqlite_stats_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(sqlite_SharedStats)));
+}
+
+static void
+sqlite_stats_shmem_startup(void)
+{
+	bool found;
+	int i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	sqlite_stats = ShmemInitStruct("sqlite stats", sizeof(sqlite_SharedStats), &found);
+	if (!found)
+	{
+		for (i = 0; i < SQLITE_STAT_NUM_KINDS; i++)
+		{
+			pg_atomic_init_u64(&sqlite_stats->counters[i].calls, 0);
+			pg_atomic_init_u64(&sqlite_stats->counters[i].bytes, 0);
+			pg_atomic_init_u64(&sqlite_stats->counters[i].time, 0);
+		}
+		pg_atomic_init_u64(&sqlite_stats->stats_reset, (uint64) GetCurrentTimestamp());
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/* Add the counts of this backend to the shared counters */
+static void
+sqlite_stats_flush(void)
+{
+	int i;
+
+	if (!sqlite_have_pending || sqlite_stats == NULL)
+		return;
+
+	for (i = 0; i < SQLITE_STAT_NUM_KINDS; i++)
+	{
+		sqlite_LocalCounter *pending = &sqlite_pending[i];
+		sqlite_StatCounter *counter = &sqlite_stats->counters[i];
+
+		if (pending->calls == 0)
+			continue;
+		pg_atomic_fetch_add_u64(&counter->calls, pending->calls);
+		if (pending->bytes > 0)
+			pg_atomic_fetch_add_u64(&counter->bytes, pending->bytes);
+		if (pending->time > 0)
+			pg_atomic_fetch_add_u64(&counter->time, pending->time);
+	}
+	memset(sqlite_pending, 0, sizeof(sqlite_pending));
+	sqlite_have_pending = false;
+}
+
+static void
+sqlite_stats_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		case XACT_EVENT_PREPARE:
+			sqlite_stats_flush();
+			break;
+		default:
+			break;
+	}
+}
+
+/* Ask for the shared memory, only possible while preloading */
+void
+sqlite_stats_init(void)
+{
+	LOGF();
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = sqlite_stats_shmem_request;
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = sqlite_stats_shmem_startup;
+	RegisterXactCallback(sqlite_stats_xact_callback, NULL);
+}
+
+/* Count an event of kind that handled bytes and began at start */
+void
+sqlite_stats_add(sqlite_StatKind kind, uint64 bytes, instr_time start)
+{
+	sqlite_LocalCounter *pending;
+	instr_time duration;
+
+	if (sqlite_stats == NULL)
+		return;
+
+	pending = &sqlite_pending[kind];
+	pending->calls++;
+	pending->bytes += bytes;
+	/* Timing may have been turned on since the event began */
+	if (sqlite_track_timing && !INSTR_TIME_IS_ZERO(start))
+	{
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, start);
+		pending->time += INSTR_TIME_GET_NANOSEC(duration);
+	}
+	sqlite_have_pending = true;
+}
+
+/* sqlite3_step(), counted */
+int
+sqlite_step(sqlite3_stmt *stmt)
+{
+	instr_time start;
+	int rc;
+
+	if (sqlite_stats == NULL)
+		return sqlite3_step(stmt);
+
+	SQLITE_STATS_START(start);
+	rc = sqlite3_step(stmt);
+	sqlite_stats_add(SQLITE_STAT_STEP, 0, start);
+	return rc;
+}
+
+static void
+sqlite_stats_check(void)
+{
+	if (sqlite_stats == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("sqlite statistics are not available"),
+				 errhint("Add sqlite to shared_preload_libraries.")));
+}
+
+/* One row per counted event, with its calls, bytes and time in ms */
+Datum
+pg_stat_sqlite(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Datum values[5];
+	bool nulls[5] = {false, false, false, false, false};
+	int i;
+
+	LOGF();
+
+	sqlite_stats_check();
+	/* Include what this backend counted so far */
+	sqlite_stats_flush();
+	InitMaterializedSRF(fcinfo, 0);
+
+	for (i = 0; i < SQLITE_STAT_NUM_KINDS; i++)
+	{
+		sqlite_StatCounter *counter = &sqlite_stats->counters[i];
+
+		values[0] = CStringGetTextDatum(sqlite_stat_names[i]);
+		values[1] = Int64GetDatum((int64) pg_atomic_read_u64(&counter->calls));
+		values[2] = Int64GetDatum((int64) pg_atomic_read_u64(&counter->bytes));
+		values[3] = Float8GetDatum((double) pg_atomic_read_u64(&counter->time) / 1e6);
+		values[4] = TimestampTzGetDatum((TimestampTz) pg_atomic_read_u64(&sqlite_stats->stats_reset));
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+	return (Datum) 0;
+}
+
+Datum
+pg_stat_sqlite_reset(PG_FUNCTION_ARGS)
+{
+	int i;
+
+	LOGF();
+
+	sqlite_stats_check();
+	for (i = 0; i < SQLITE_STAT_NUM_KINDS; i++)
+	{
+		pg_atomic_write_u64(&sqlite_stats->counters[i].calls, 0);
+		pg_atomic_write_u64(&sqlite_stats->counters[i].bytes, 0);
+		pg_atomic_write_u64(&sqlite_stats->counters[i].time, 0);
+	}
+	pg_atomic_write_u64(&sqlite_stats->stats_reset, (uint64) GetCurrentTimestamp());
+	PG_RETURN_VOID();
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
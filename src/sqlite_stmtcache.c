@@ -0,0 +1,327 @@
+#include "sqlite.h"
+
+#include "access/xact.h"
+
+/* Per-database LRU cache of prepared statements.
+
+   The cache is a small array owned by the expanded object and allocated
+   in its memory context.  It is searched linearly, which is cheaper
+   than hashing for the handful of statements a typical workload runs
+   against each database.  Statements are prepared with
+   SQLITE_PREPARE_PERSISTENT since they are expected to be reused.
+*/
+
+int sqlite_stmt_cache_size = 16;
+
+/* Skip whitespace and find out if anything is left of a query */
+static bool
+sqlite_query_is_empty(const char *query)
+{
+	while (*query == ' ' || *query == '\t' || *query == '\n' || *query == '\r')
+		query++;
+	return *query == '\0';
+}
+
+sqlite3_stmt *
+sqlite_prepare_cached(sqlite_Sqlite *sqlite, const char *query, const char **tail)
+{
+	return sqlite_prepare_cached_ext(sqlite, query, tail, NULL);
+}
+
+sqlite3_stmt *
+sqlite_prepare_cached_ext(sqlite_Sqlite *sqlite, const char *query, const char **tail,
+						  bool *failed)
+{
+	sqlite_CachedStmt *entry = NULL;
+	sqlite3_stmt *stmt;
+	const char *stmt_tail;
+	instr_time start;
+	int rc;
+	int i;
+
+	LOGF();
+
+	Assert(sqlite->em_magic == sqlite_MAGIC);
+
+	if (failed)
+		*failed = false;
+
+	/* Look for an idle statement prepared from the same text */
+	for (i = 0; i < sqlite->stmt_cache_len; i++)
+	{
+		entry = &sqlite->stmt_cache[i];
+		if (!entry->in_use && strcmp(entry->sql, query) == 0)
+		{
+			entry->in_use = true;
+			entry->subxid = GetCurrentSubTransactionId();
+			entry->last_used = ++sqlite->stmt_cache_clock;
+			sqlite->stmt_cache_hits++;
+			if (tail)
+				*tail = query + entry->tail_offset;
+			return entry->stmt;
+		}
+	}
+
+	sqlite->stmt_cache_misses++;
+
+	SQLITE_STATS_START(start);
+	sqlite->restrict_sql = sqlite->readonly;
+	sqlite->restrict_denied = false;
+	rc = sqlite3_prepare_v3(sqlite->db, query, -1, SQLITE_PREPARE_PERSISTENT,
+							&stmt, &stmt_tail);
+	sqlite->restrict_sql = false;
+	if (rc != SQLITE_OK && failed != NULL)
+	{
+		sqlite_store_check_error(&sqlite->store);
+		*failed = true;
+		return NULL;
+	}
+	/* The parser may go on after a denial and report another error */
+	if (rc != SQLITE_OK && sqlite->restrict_denied)
+		ereport(ERROR,
+				(errcode(ERRCODE_READ_ONLY_SQL_TRANSACTION),
+				 errmsg("SQLite query may only read a stored database: %s",
+						sqlite3_errmsg(sqlite->db)),
+				 errhint("Use sqlite_exec() to change a database.")));
+	if (rc != SQLITE_OK)
+	{
+		sqlite_store_check_error(&sqlite->store);
+		ereport(ERROR, (errmsg("Failed to prepare SQLite query: %s", sqlite3_errmsg(sqlite->db))));
+	}
+	sqlite_stats_add(SQLITE_STAT_PREPARE, 0, start);
+
+	if (tail)
+		*tail = sqlite_query_is_empty(stmt_tail) ? NULL : stmt_tail;
+
+	/* Nothing but whitespace or comments */
+	if (stmt == NULL)
+		return NULL;
+
+	if (sqlite->stmt_cache == NULL)
+	{
+		sqlite->stmt_cache_size = sqlite_stmt_cache_size;
+		if (sqlite->stmt_cache_size <= 0)
+			return stmt;
+		sqlite->stmt_cache = MemoryContextAllocZero(sqlite->hdr.eoh_context,
+													sizeof(sqlite_CachedStmt) * sqlite->stmt_cache_size);
+	}
+
+	/* Use a free slot, or evict the least recently used idle statement */
+	entry = NULL;
+	if (sqlite->stmt_cache_len < sqlite->stmt_cache_size)
+		entry = &sqlite->stmt_cache[sqlite->stmt_cache_len++];
+	else
+	{
+		for (i = 0; i < sqlite->stmt_cache_len; i++)
+		{
+			sqlite_CachedStmt *candidate = &sqlite->stmt_cache[i];
+
+			if (!candidate->in_use &&
+				(entry == NULL || candidate->last_used < entry->last_used))
+				entry = candidate;
+		}
+		/* Everything is busy, hand out an uncached statement */
+		if (entry == NULL)
+			return stmt;
+		sqlite3_finalize(entry->stmt);
+		pfree(entry->sql);
+	}
+
+	entry->sql = MemoryContextStrdup(sqlite->hdr.eoh_context, query);
+	entry->stmt = stmt;
+	entry->tail_offset = stmt_tail - query;
+	entry->last_used = ++sqlite->stmt_cache_clock;
+	entry->in_use = true;
+	entry->subxid = GetCurrentSubTransactionId();
+	return stmt;
+}
+
+void
+sqlite_release_stmt(sqlite_Sqlite *sqlite, sqlite3_stmt *stmt)
+{
+	int i;
+
+	LOGF();
+
+	for (i = 0; i < sqlite->stmt_cache_len; i++)
+	{
+		if (sqlite->stmt_cache[i].stmt == stmt)
+		{
+			sqlite3_reset(stmt);
+			sqlite3_clear_bindings(stmt);
+			sqlite->stmt_cache[i].in_use = false;
+			return;
+		}
+	}
+	sqlite3_finalize(stmt);
+}
+
+void
+sqlite_stmt_cache_clear(sqlite_Sqlite *sqlite)
+{
+	int i;
+
+	LOGF();
+
+	for (i = 0; i < sqlite->stmt_cache_len; i++)
+	{
+		sqlite3_finalize(sqlite->stmt_cache[i].stmt);
+		pfree(sqlite->stmt_cache[i].sql);
+	}
+	sqlite->stmt_cache_len = 0;
+}
+
+/* Reset every statement of a database that outlives the query that
+   used it, after an error left scans unfinished.  Statements that were
+   never cached are finalized. */
+void
+sqlite_stmt_cache_reset(sqlite_Sqlite *sqlite)
+{
+	sqlite3_stmt *stmt = NULL;
+	sqlite3_stmt *next;
+	int i;
+
+	LOGF();
+
+	for (i = 0; i < sqlite->stmt_cache_len; i++)
+	{
+		sqlite3_reset(sqlite->stmt_cache[i].stmt);
+		sqlite3_clear_bindings(sqlite->stmt_cache[i].stmt);
+		sqlite->stmt_cache[i].in_use = false;
+	}
+
+	next = sqlite3_next_stmt(sqlite->db, NULL);
+	while ((stmt = next) != NULL)
+	{
+		next = sqlite3_next_stmt(sqlite->db, stmt);
+		for (i = 0; i < sqlite->stmt_cache_len; i++)
+			if (sqlite->stmt_cache[i].stmt == stmt)
+				break;
+		if (i == sqlite->stmt_cache_len)
+			sqlite3_finalize(stmt);
+	}
+}
+
+/* A subtransaction abort skips the release of the statements its scans
+   were stepping, hand them back so the cache can use them again.
+   Statements that were never cached are left to the end of the
+   transaction. */
+void
+sqlite_stmt_cache_abort_sub(sqlite_Sqlite *sqlite, SubTransactionId subxid)
+{
+	int i;
+
+	LOGF();
+
+	for (i = 0; i < sqlite->stmt_cache_len; i++)
+	{
+		sqlite_CachedStmt *entry = &sqlite->stmt_cache[i];
+
+		if (entry->in_use && entry->subxid == subxid)
+		{
+			sqlite3_reset(entry->stmt);
+			sqlite3_clear_bindings(entry->stmt);
+			entry->in_use = false;
+		}
+	}
+}
+
+/* Scans of a committed subtransaction now belong to its parent. */
+void
+sqlite_stmt_cache_commit_sub(sqlite_Sqlite *sqlite, SubTransactionId subxid,
+							 SubTransactionId parent)
+{
+	int i;
+
+	LOGF();
+
+	for (i = 0; i < sqlite->stmt_cache_len; i++)
+	{
+		sqlite_CachedStmt *entry = &sqlite->stmt_cache[i];
+
+		if (entry->in_use && entry->subxid == subxid)
+			entry->subxid = parent;
+	}
+}
+
+/* Read-only databases are mapped from a stored value, or shared by all
+   queries of the backend through the cache.  Statements of the caller
+   may read them, but must not leave anything behind on the connection:
+   no temporary schema, attached databases or changed pragmas.  The
+   extension's own statements, such as the transaction of a dump, are
+   prepared with restrict_sql unset. */
+int
+sqlite_readonly_authorizer(void *arg, int action, const char *arg1, const char *arg2,
+						   const char *dbname, const char *trigger)
+{
+	sqlite_Sqlite *sqlite = (sqlite_Sqlite *) arg;
+
+	if (!sqlite->restrict_sql)
+		return SQLITE_OK;
+
+	switch (action)
+	{
+		case SQLITE_SELECT:
+		case SQLITE_READ:
+		case SQLITE_FUNCTION:
+		case SQLITE_RECURSIVE:
+			return SQLITE_OK;
+		case SQLITE_UPDATE:
+			/* Asked when a pragma function connects its virtual table */
+			if (strcmp(arg1, "sqlite_master") == 0 &&
+				dbname != NULL && strcmp(dbname, "main") == 0)
+				return SQLITE_OK;
+			break;
+		case SQLITE_PRAGMA:
+			/* Reading a pragma, or one that reports on its argument */
+			if (arg2 == NULL ||
+				pg_strcasecmp(arg1, "table_info") == 0 ||
+				pg_strcasecmp(arg1, "table_xinfo") == 0 ||
+				pg_strcasecmp(arg1, "table_list") == 0 ||
+				pg_strcasecmp(arg1, "index_info") == 0 ||
+				pg_strcasecmp(arg1, "index_xinfo") == 0 ||
+				pg_strcasecmp(arg1, "index_list") == 0 ||
+				pg_strcasecmp(arg1, "foreign_key_list") == 0 ||
+				pg_strcasecmp(arg1, "foreign_key_check") == 0 ||
+				pg_strcasecmp(arg1, "integrity_check") == 0 ||
+				pg_strcasecmp(arg1, "quick_check") == 0)
+				return SQLITE_OK;
+			break;
+		default:
+			break;
+	}
+	sqlite->restrict_denied = true;
+	return SQLITE_DENY;
+}
+
+PG_FUNCTION_INFO_V1(sqlite_stmt_cache_stats);
+Datum
+sqlite_stmt_cache_stats(PG_FUNCTION_ARGS)
+{
+	sqlite_Sqlite *sqlite;
+	TupleDesc tupdesc;
+	Datum values[3];
+	bool nulls[3] = {false, false, false};
+
+	LOGF();
+
+	sqlite = SQLITE_GETARG_RO(0);
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	values[0] = Int64GetDatum(sqlite->stmt_cache_hits);
+	values[1] = Int64GetDatum(sqlite->stmt_cache_misses);
+	values[2] = Int32GetDatum(sqlite->stmt_cache_len);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -0,0 +1,246 @@
+#include "sqlite.h"
+
+#include "nodes/supportnodes.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+
+PG_FUNCTION_INFO_V1(sqlite_query_support);
+
+/* Planner estimates for sqlite_query().
+
+   When the database and the query are constants by the time they are
+   planned, the rows of the query are estimated from the plan SQLite
+   makes for it and the statistics ANALYZE keeps in sqlite_stat1 of the
+   database: a full scan of a table returns all of its rows, a search
+   through an index the average rows per key of as many columns of the
+   index as are compared for equality, and the rows of each loop of a
+   join multiply.  Filters the plan doesn't show, and aggregation, are
+   not accounted for.
+
+   Otherwise, or when a table of the plan has no statistics, the rows
+   are sqlite.query_rows.  The planner charges the cost of the function
+   of a function scan once per scan, for all the rows it returns, so
+   the cost of a call is sqlite.query_cost times cpu_operator_cost for
+   each row estimated.  Unlike the COST of a function, which is charged
+   once per call whatever the rows, it grows with the query.
+*/
+
+int sqlite_query_rows = 1000;
+double sqlite_query_cost = 1.0;
+
+/* SQLite's estimate of the rows a range condition leaves */
+#define SQLITE_RANGE_SELECTIVITY 0.25
+
+/* Read the integers of a sqlite_stat1 row of tbl, for idx or for any
+   index of tbl when idx is NULL.  Returns how many were read, 0 when
+   there are no statistics. */
+static int
+sqlite_support_stat1(sqlite_Sqlite *sqlite, const char *tbl, const char *idx,
+					 double *values, int maxvalues)
+{
+	sqlite3_stmt *stmt;
+	bool failed;
+	int nvalues = 0;
+
+	/* Fails when no ANALYZE has been run */
+	stmt = sqlite_prepare_cached_ext(sqlite,
+									 "SELECT stat FROM sqlite_stat1 WHERE tbl = ?1 AND (?2 IS NULL OR idx = ?2)"
+									 " ORDER BY CAST(stat AS INTEGER) DESC LIMIT 1",
+									 NULL, &failed);
+	if (stmt == NULL)
+		return 0;
+
+	sqlite3_bind_text(stmt, 1, tbl, -1, SQLITE_STATIC);
+	if (idx)
+		sqlite3_bind_text(stmt, 2, idx, -1, SQLITE_STATIC);
+
+	if (sqlite_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) == SQLITE_TEXT)
+	{
+		const char *stat = (const char *) sqlite3_column_text(stmt, 0);
+		char *end;
+
+		while (nvalues < maxvalues)
+		{
+			long value = strtol(stat, &end, 10);
+
+			if (end == stat)
+				break;
+			values[nvalues++] = (double) value;
+			stat = end;
+		}
+	}
+	sqlite_release_stmt(sqlite, stmt);
+	sqlite_store_check_error(&sqlite->store);
+	return nvalues;
+}
+
+/* Estimate the rows of one loop of a plan from its EXPLAIN QUERY PLAN
+   detail, like "SCAN t" or "SEARCH t USING INDEX i (a=? AND b>?)".
+   Details of anything but a scan or search count as one row.  Returns
+   false when there are no statistics for the table. */
+static bool
+sqlite_support_node_rows(sqlite_Sqlite *sqlite, const char *detail, double *rows)
+{
+	double stat[16];
+	const char *p;
+	const char *terms;
+	const char *index;
+	char *tbl;
+	char *idx = NULL;
+	bool search;
+	bool range;
+	int nstat;
+	int neq = 0;
+
+	*rows = 1;
+	if (strncmp(detail, "SCAN ", 5) == 0)
+	{
+		search = false;
+		p = detail + 5;
+	}
+	else if (strncmp(detail, "SEARCH ", 7) == 0)
+	{
+		search = true;
+		p = detail + 7;
+	}
+	else
+		return true;
+
+	/* SQLite before 3.36 says SCAN TABLE t */
+	if (strncmp(p, "TABLE ", 6) == 0)
+		p += 6;
+	if (strcmp(p, "CONSTANT ROW") == 0)
+		return true;
+	tbl = pnstrdup(p, strcspn(p, " "));
+
+	terms = search ? strchr(p, '(') : NULL;
+	range = terms && (strchr(terms, '<') || strchr(terms, '>'));
+	for (p = terms; p && (p = strstr(p, "=?")); p += 2)
+		neq++;
+
+	/* A rowid lookup needs no statistics */
+	if (search && neq > 0 && strstr(detail, "INTEGER PRIMARY KEY") != NULL)
+		return true;
+
+	nstat = sqlite_support_stat1(sqlite, tbl, NULL, stat, 1);
+	if (nstat == 0)
+		return false;
+	*rows = stat[0];
+	if (!search)
+		return true;
+
+	if ((index = strstr(detail, " INDEX ")) != NULL &&
+		strstr(detail, "INTEGER PRIMARY KEY") == NULL)
+	{
+		index += 7;
+		idx = pnstrdup(index, strcspn(index, " ("));
+		nstat = sqlite_support_stat1(sqlite, tbl, idx, stat, lengthof(stat));
+		if (neq > 0 && nstat > 0)
+			*rows = stat[Min(neq, nstat - 1)];
+	}
+
+	if (range)
+		*rows *= SQLITE_RANGE_SELECTIVITY;
+	*rows = Max(*rows, 1);
+	return true;
+}
+
+/* Estimate the rows of the first statement of query from the plan of
+   SQLite, or return -1 if they can't be. */
+static double
+sqlite_support_plan_rows(sqlite_Sqlite *sqlite, const char *query)
+{
+	sqlite3_stmt *plan;
+	char *sql = psprintf("EXPLAIN QUERY PLAN %s", query);
+	double rows = 1;
+	bool failed;
+	bool found = false;
+
+	/* Leave errors in the query to be reported when it runs */
+	plan = sqlite_prepare_cached_ext(sqlite, sql, NULL, &failed);
+	pfree(sql);
+	if (plan == NULL)
+		return -1;
+
+	while (sqlite_step(plan) == SQLITE_ROW)
+	{
+		double node_rows;
+
+		/* Only the loops of the top level query, not its subqueries */
+		if (sqlite3_column_int(plan, 1) != 0)
+			continue;
+		if (!sqlite_support_node_rows(sqlite, (const char *) sqlite3_column_text(plan, 3),
+									  &node_rows))
+		{
+			found = false;
+			break;
+		}
+		rows *= node_rows;
+		found = true;
+	}
+	sqlite_release_stmt(sqlite, plan);
+	sqlite_store_check_error(&sqlite->store);
+	return found ? rows : -1;
+}
+
+/* Estimate the rows of a call of sqlite_query() */
+static double
+sqlite_support_rows(PlannerInfo *root, Node *node)
+{
+	FuncExpr *call = (FuncExpr *) node;
+	Node *dbarg;
+	Node *queryarg;
+	double rows;
+
+	if (node == NULL || !IsA(node, FuncExpr) || list_length(call->args) < 2)
+		return sqlite_query_rows;
+
+	dbarg = linitial(call->args);
+	queryarg = lsecond(call->args);
+	if (root != NULL)
+	{
+		dbarg = estimate_expression_value(root, dbarg);
+		queryarg = estimate_expression_value(root, queryarg);
+	}
+	if (!IsA(dbarg, Const) || ((Const *) dbarg)->constisnull ||
+		!IsA(queryarg, Const) || ((Const *) queryarg)->constisnull)
+		return sqlite_query_rows;
+
+	rows = sqlite_support_plan_rows(DatumGetSqliteReadOnly(((Const *) dbarg)->constvalue),
+									TextDatumGetCString(((Const *) queryarg)->constvalue));
+	return rows < 0 ? sqlite_query_rows : rows;
+}
+
+Datum
+sqlite_query_support(PG_FUNCTION_ARGS)
+{
+	Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+	Node *ret = NULL;
+
+	LOGF();
+
+	if (IsA(rawreq, SupportRequestRows))
+	{
+		SupportRequestRows *req = (SupportRequestRows *) rawreq;
+
+		req->rows = sqlite_support_rows(req->root, req->node);
+		ret = (Node *) req;
+	}
+	else if (IsA(rawreq, SupportRequestCost))
+	{
+		SupportRequestCost *req = (SupportRequestCost *) rawreq;
+
+		/* per_tuple is charged once per call */
+		req->startup = 0;
+		req->per_tuple = sqlite_query_cost * cpu_operator_cost *
+			sqlite_support_rows(req->root, req->node);
+		ret = (Node *) req;
+	}
+
+	PG_RETURN_POINTER(ret);
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -0,0 +1,680 @@
+#include "sqlite.h"
+
+#include "access/detoast.h"
+#include "access/xact.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
+
+/* An SQLite VFS that keeps the main database file of each expanded
+   sqlite in its page store.
+
+   Pages are allocated in the memory context of the expanded object, so
+   the memory a database uses shows up under "expanded sqlite" in
+   pg_backend_memory_contexts and is released with the object.  A store
+   can be backed by a base image, typically the detoasted flat datum.
+   Pages are read straight from the image until they are first written,
+   at which point the page is copied into the store.  A packed image,
+   see sqlite_pack.c, is decompressed one page at a time as SQLite reads
+   it.  A large database stored out of line can also be read straight
+   from TOAST, a slice at a time, without detoasting it first.
+   Flattening reads the pages straight into the result buffer.
+
+   Only the main database file lives in a store.  Connections are
+   opened with an in-memory rollback journal and in-memory temp storage.
+   Anonymous temp files are passed to the default VFS, no other file can
+   be opened.
+*/
+
+#define SQLITE_VFS_NAME "postgres"
+
+/* Size of the slices a database is fetched from TOAST in */
+#define SQLITE_TOAST_WINDOW (8 * SQLITE_STORE_PAGE_SIZE)
+
+int sqlite_lazy_load_threshold = 1024;
+
+typedef struct sqlite_VfsFile {
+	sqlite3_file base;
+	sqlite_PageStore *store;
+} sqlite_VfsFile;
+
+static sqlite3_vfs *sqlite_parent_vfs = NULL;
+
+/* Store the next main database file opened will use */
+static sqlite_PageStore *sqlite_vfs_pending = NULL;
+
+void
+sqlite_store_init(sqlite_PageStore *store, MemoryContext cxt)
+{
+	store->cxt = cxt;
+	store->size = 0;
+	store->npages = 0;
+	store->maxpages = 0;
+	store->pages = NULL;
+	store->image = NULL;
+	store->image_size = 0;
+	store->packed = NULL;
+	store->format = SQLITE_FORMAT_RAW;
+	store->unpacked = NULL;
+	store->unpacked_pgno = -1;
+	store->toast = NULL;
+	store->toast_offset = 0;
+	store->window = NULL;
+	store->window_start = 0;
+	store->window_len = 0;
+	store->error = NULL;
+	store->writes = 0;
+}
+
+/* Back the store with a database image.  The image must outlive the
+   store, and must be set before the database is first read. */
+void
+sqlite_store_set_image(sqlite_PageStore *store, const unsigned char *image, Size size)
+{
+	store->image = image;
+	store->image_size = size;
+	store->size = size;
+}
+
+/* Read the image from the TOAST value toast points to, size bytes of
+   it starting at offset, instead of from memory.  The pointer is
+   copied, but the value must stay visible to the snapshots it is read
+   with. */
+void
+sqlite_store_set_toast(sqlite_PageStore *store, struct varlena *toast, int64 offset, int64 size)
+{
+	store->toast = MemoryContextAlloc(store->cxt, VARSIZE_EXTERNAL(toast));
+	memcpy(store->toast, toast, VARSIZE_EXTERNAL(toast));
+	store->toast_offset = offset;
+	store->window = MemoryContextAlloc(store->cxt, SQLITE_TOAST_WINDOW);
+	store->window_start = 0;
+	store->window_len = 0;
+	store->image = NULL;
+	store->image_size = size;
+	store->size = size;
+}
+
+/* Fetch the window of the TOAST value holding offset.  Errors can't be
+   thrown through SQLite, so they are kept for sqlite_store_check_error()
+   and false is returned.  The fetch runs in a subtransaction, so that
+   whatever it held when it failed is released before SQLite carries on.
+   Once a fetch has failed nothing more is fetched, the statement is
+   bound to fail anyway. */
+static bool
+sqlite_store_fetch_window(sqlite_PageStore *store, int64 offset)
+{
+	MemoryContext oldcxt = CurrentMemoryContext;
+	ResourceOwner oldowner = CurrentResourceOwner;
+	int64 start = offset - offset % SQLITE_TOAST_WINDOW;
+	int64 len = Min(SQLITE_TOAST_WINDOW, (int64) store->image_size - start);
+	volatile bool ok = true;
+
+	store->window_len = 0;
+	if (store->error != NULL)
+		return false;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcxt);
+	PG_TRY();
+	{
+		struct varlena *slice;
+
+		slice = detoast_attr_slice(store->toast, store->toast_offset + start, len);
+		if (VARSIZE(slice) - VARHDRSZ != len)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("sqlite database value is shorter than expected")));
+		memcpy(store->window, VARDATA(slice), len);
+		pfree(slice);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcxt);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(store->cxt);
+		store->error = CopyErrorData();
+		FlushErrorState();
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcxt);
+		CurrentResourceOwner = oldowner;
+		ok = false;
+	}
+	PG_END_TRY();
+
+	if (ok)
+	{
+		store->window_start = start;
+		store->window_len = len;
+	}
+	return ok;
+}
+
+/* Read from the base image.  A packed image is decompressed a page at
+   a time, keeping the last page around for the reads that follow it.
+   An image in TOAST is fetched a window at a time.  Returns false if a
+   page fails to decompress or the fetch fails. */
+static bool
+sqlite_store_read_image(sqlite_PageStore *store, unsigned char *buf, int64 amount, int64 offset)
+{
+	int64 page_size;
+
+	if (store->toast != NULL)
+	{
+		while (amount > 0)
+		{
+			int64 n;
+
+			if (offset < store->window_start ||
+				offset >= store->window_start + store->window_len)
+			{
+				if (!sqlite_store_fetch_window(store, offset))
+					return false;
+			}
+			n = Min(amount, store->window_start + store->window_len - offset);
+			memcpy(buf, store->window + (offset - store->window_start), n);
+
+			buf += n;
+			offset += n;
+			amount -= n;
+		}
+		return true;
+	}
+
+	if (store->packed == NULL)
+	{
+		memcpy(buf, store->image + offset, amount);
+		return true;
+	}
+
+	page_size = store->packed->page_size;
+	while (amount > 0)
+	{
+		int64 pgno = offset / page_size;
+		int64 pgoff = offset % page_size;
+		int64 n = Min(amount, page_size - pgoff);
+
+		if (pgno != store->unpacked_pgno)
+		{
+			store->unpacked_pgno = -1;
+			if (!sqlite_unpack_page(store->packed, store->format, pgno, store->unpacked))
+				return false;
+			store->unpacked_pgno = pgno;
+		}
+		memcpy(buf, store->unpacked + pgoff, n);
+
+		buf += n;
+		offset += n;
+		amount -= n;
+	}
+	return true;
+}
+
+bool
+sqlite_store_read(sqlite_PageStore *store, unsigned char *buf, int64 amount, int64 offset)
+{
+	while (amount > 0)
+	{
+		int64 pgno = offset / SQLITE_STORE_PAGE_SIZE;
+		int64 pgoff = offset % SQLITE_STORE_PAGE_SIZE;
+		int64 n = Min(amount, SQLITE_STORE_PAGE_SIZE - pgoff);
+
+		if (offset >= store->size)
+		{
+			memset(buf, 0, amount);
+			return true;
+		}
+		n = Min(n, store->size - offset);
+
+		if (pgno < store->npages && store->pages[pgno] != NULL)
+			memcpy(buf, store->pages[pgno] + pgoff, n);
+		else if (offset < (int64) store->image_size)
+		{
+			/* The image may end inside the page */
+			int64 avail = Min(n, (int64) store->image_size - offset);
+
+			if (!sqlite_store_read_image(store, buf, avail, offset))
+				return false;
+			memset(buf + avail, 0, n - avail);
+		}
+		else
+			memset(buf, 0, n);
+
+		buf += n;
+		offset += n;
+		amount -= n;
+	}
+	return true;
+}
+
+void
+sqlite_store_read_error(sqlite_PageStore *store)
+{
+	sqlite_store_check_error(store);
+	ereport(ERROR,
+			(errcode(ERRCODE_DATA_CORRUPTED),
+			 errmsg("sqlite database image is corrupt")));
+}
+
+void
+sqlite_store_check_error(sqlite_PageStore *store)
+{
+	ErrorData *edata = store->error;
+
+	if (edata != NULL)
+	{
+		store->error = NULL;
+		ReThrowError(edata);
+	}
+}
+
+/* Make page pgno private to the store, copying it from the image.
+   Returns NULL when out of memory or if the image page is corrupt,
+   since this runs inside SQLite. */
+static unsigned char *
+sqlite_store_materialize(sqlite_PageStore *store, int64 pgno)
+{
+	unsigned char *page;
+	int64 offset = pgno * SQLITE_STORE_PAGE_SIZE;
+
+	if (pgno >= store->maxpages)
+	{
+		int64 newmax = Max(store->maxpages * 2, 64);
+		unsigned char **pages;
+
+		while (newmax <= pgno)
+			newmax *= 2;
+		pages = MemoryContextAllocExtended(store->cxt, newmax * sizeof(unsigned char *),
+										   MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM | MCXT_ALLOC_ZERO);
+		if (pages == NULL)
+			return NULL;
+		if (store->pages != NULL)
+		{
+			memcpy(pages, store->pages, store->npages * sizeof(unsigned char *));
+			pfree(store->pages);
+		}
+		store->pages = pages;
+		store->maxpages = newmax;
+	}
+
+	if (pgno < store->npages && store->pages[pgno] != NULL)
+		return store->pages[pgno];
+
+	page = MemoryContextAllocExtended(store->cxt, SQLITE_STORE_PAGE_SIZE,
+									  MCXT_ALLOC_NO_OOM | MCXT_ALLOC_ZERO);
+	if (page == NULL)
+		return NULL;
+	if (offset < (int64) store->image_size &&
+		!sqlite_store_read_image(store, page,
+								 Min(SQLITE_STORE_PAGE_SIZE, (int64) store->image_size - offset),
+								 offset))
+	{
+		pfree(page);
+		return NULL;
+	}
+	store->pages[pgno] = page;
+	if (pgno >= store->npages)
+		store->npages = pgno + 1;
+	return page;
+}
+
+static bool
+sqlite_store_write(sqlite_PageStore *store, const unsigned char *buf, int64 amount, int64 offset)
+{
+	int64 end = offset + amount;
+
+	store->writes++;
+	while (amount > 0)
+	{
+		int64 pgno = offset / SQLITE_STORE_PAGE_SIZE;
+		int64 pgoff = offset % SQLITE_STORE_PAGE_SIZE;
+		int64 n = Min(amount, SQLITE_STORE_PAGE_SIZE - pgoff);
+		unsigned char *page = sqlite_store_materialize(store, pgno);
+
+		if (page == NULL)
+			return false;
+		memcpy(page + pgoff, buf, n);
+		buf += n;
+		offset += n;
+		amount -= n;
+	}
+	if (end > store->size)
+		store->size = end;
+	return true;
+}
+
+static bool
+sqlite_store_truncate(sqlite_PageStore *store, int64 size)
+{
+	int64 pgno;
+	int64 first_free = (size + SQLITE_STORE_PAGE_SIZE - 1) / SQLITE_STORE_PAGE_SIZE;
+
+	if (size >= store->size)
+		return true;
+	store->writes++;
+
+	/* Zero the tail of a partial last page so growing again reads zeros */
+	if (size % SQLITE_STORE_PAGE_SIZE != 0)
+	{
+		unsigned char *page = sqlite_store_materialize(store, size / SQLITE_STORE_PAGE_SIZE);
+		int64 pgoff = size % SQLITE_STORE_PAGE_SIZE;
+
+		if (page == NULL)
+			return false;
+		memset(page + pgoff, 0, SQLITE_STORE_PAGE_SIZE - pgoff);
+	}
+
+	for (pgno = first_free; pgno < store->npages; pgno++)
+	{
+		if (store->pages[pgno] != NULL)
+		{
+			pfree(store->pages[pgno]);
+			store->pages[pgno] = NULL;
+		}
+	}
+	store->npages = Min(store->npages, first_free);
+	store->image_size = Min(store->image_size, (Size) size);
+	store->size = size;
+	return true;
+}
+
+/* sqlite3_io_methods for store backed files */
+
+static int
+sqlite_vfs_close(sqlite3_file *file)
+{
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_read(sqlite3_file *file, void *buf, int amount, sqlite3_int64 offset)
+{
+	sqlite_PageStore *store = ((sqlite_VfsFile *) file)->store;
+
+	if (!sqlite_store_read(store, buf, amount, offset))
+		return SQLITE_IOERR_READ;
+	if (offset + amount > store->size)
+		return SQLITE_IOERR_SHORT_READ;
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_write(sqlite3_file *file, const void *buf, int amount, sqlite3_int64 offset)
+{
+	sqlite_PageStore *store = ((sqlite_VfsFile *) file)->store;
+
+	if (!sqlite_store_write(store, buf, amount, offset))
+		return SQLITE_IOERR_NOMEM;
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_truncate(sqlite3_file *file, sqlite3_int64 size)
+{
+	sqlite_PageStore *store = ((sqlite_VfsFile *) file)->store;
+
+	if (!sqlite_store_truncate(store, size))
+		return SQLITE_IOERR_NOMEM;
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_sync(sqlite3_file *file, int flags)
+{
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_file_size(sqlite3_file *file, sqlite3_int64 *size)
+{
+	*size = ((sqlite_VfsFile *) file)->store->size;
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_lock(sqlite3_file *file, int lock)
+{
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_check_reserved_lock(sqlite3_file *file, int *result)
+{
+	*result = 0;
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_file_control(sqlite3_file *file, int op, void *arg)
+{
+	return SQLITE_NOTFOUND;
+}
+
+static int
+sqlite_vfs_sector_size(sqlite3_file *file)
+{
+	return SQLITE_STORE_PAGE_SIZE;
+}
+
+static int
+sqlite_vfs_device_characteristics(sqlite3_file *file)
+{
+	return SQLITE_IOCAP_ATOMIC |
+		SQLITE_IOCAP_POWERSAFE_OVERWRITE |
+		SQLITE_IOCAP_SAFE_APPEND |
+		SQLITE_IOCAP_SEQUENTIAL;
+}
+
+static const sqlite3_io_methods sqlite_vfs_io_methods = {
+	1,
+	sqlite_vfs_close,
+	sqlite_vfs_read,
+	sqlite_vfs_write,
+	sqlite_vfs_truncate,
+	sqlite_vfs_sync,
+	sqlite_vfs_file_size,
+	sqlite_vfs_lock,
+	sqlite_vfs_lock,
+	sqlite_vfs_check_reserved_lock,
+	sqlite_vfs_file_control,
+	sqlite_vfs_sector_size,
+	sqlite_vfs_device_characteristics
+};
+
+/* sqlite3_vfs methods */
+
+static int
+sqlite_vfs_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *file,
+				int flags, int *out_flags)
+{
+	sqlite_VfsFile *vfile = (sqlite_VfsFile *) file;
+
+	if ((flags & SQLITE_OPEN_MAIN_DB) == 0 || sqlite_vfs_pending == NULL)
+	{
+		/* Temp files SQLite names itself and deletes on close, for a
+		   sort or temp table that spills with temp_store changed.  Any
+		   file named by a query, like a database it attaches or a
+		   journal next to the main database, would be a file of the
+		   server. */
+		if (name != NULL)
+			return SQLITE_CANTOPEN;
+		return sqlite_parent_vfs->xOpen(sqlite_parent_vfs, name, file, flags, out_flags);
+	}
+
+	memset(vfile, 0, sizeof(sqlite_VfsFile));
+	vfile->base.pMethods = &sqlite_vfs_io_methods;
+	vfile->store = sqlite_vfs_pending;
+	sqlite_vfs_pending = NULL;
+	if (out_flags)
+		*out_flags = flags;
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_delete(sqlite3_vfs *vfs, const char *name, int sync_dir)
+{
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_access(sqlite3_vfs *vfs, const char *name, int flags, int *result)
+{
+	/* There are never journals or other files next to a store */
+	*result = 0;
+	return SQLITE_OK;
+}
+
+static int
+sqlite_vfs_full_pathname(sqlite3_vfs *vfs, const char *name, int size, char *out)
+{
+	strlcpy(out, name, size);
+	return SQLITE_OK;
+}
+
+static void *
+sqlite_vfs_dlopen(sqlite3_vfs *vfs, const char *filename)
+{
+	return NULL;
+}
+
+static void
+sqlite_vfs_dlerror(sqlite3_vfs *vfs, int size, char *msg)
+{
+	strlcpy(msg, "loadable extensions are not supported", size);
+}
+
+static void
+(*sqlite_vfs_dlsym(sqlite3_vfs *vfs, void *handle, const char *symbol))(void)
+{
+	return NULL;
+}
+
+static void
+sqlite_vfs_dlclose(sqlite3_vfs *vfs, void *handle)
+{
+}
+
+static int
+sqlite_vfs_randomness(sqlite3_vfs *vfs, int size, char *out)
+{
+	return sqlite_parent_vfs->xRandomness(sqlite_parent_vfs, size, out);
+}
+
+static int
+sqlite_vfs_sleep(sqlite3_vfs *vfs, int microseconds)
+{
+	return sqlite_parent_vfs->xSleep(sqlite_parent_vfs, microseconds);
+}
+
+static int
+sqlite_vfs_current_time(sqlite3_vfs *vfs, double *now)
+{
+	return sqlite_parent_vfs->xCurrentTime(sqlite_parent_vfs, now);
+}
+
+static int
+sqlite_vfs_get_last_error(sqlite3_vfs *vfs, int size, char *msg)
+{
+	return 0;
+}
+
+static sqlite3_vfs sqlite_vfs = {
+	1,							/* iVersion */
+	0,							/* szOsFile, set at registration */
+	1024,						/* mxPathname */
+	NULL,						/* pNext */
+	SQLITE_VFS_NAME,			/* zName */
+	NULL,						/* pAppData */
+	sqlite_vfs_open,
+	sqlite_vfs_delete,
+	sqlite_vfs_access,
+	sqlite_vfs_full_pathname,
+	sqlite_vfs_dlopen,
+	sqlite_vfs_dlerror,
+	sqlite_vfs_dlsym,
+	sqlite_vfs_dlclose,
+	sqlite_vfs_randomness,
+	sqlite_vfs_sleep,
+	sqlite_vfs_current_time,
+	sqlite_vfs_get_last_error
+};
+
+void
+sqlite_vfs_register(void)
+{
+	LOGF();
+
+	if (sqlite_parent_vfs != NULL)
+		return;
+
+	sqlite_parent_vfs = sqlite3_vfs_find(NULL);
+	if (sqlite_parent_vfs == NULL)
+		ereport(ERROR, (errmsg("Failed to find the default SQLite VFS")));
+
+	sqlite_vfs.szOsFile = Max(sizeof(sqlite_VfsFile), sqlite_parent_vfs->szOsFile);
+	if (sqlite3_vfs_register(&sqlite_vfs, 0) != SQLITE_OK)
+		ereport(ERROR, (errmsg("Failed to register the SQLite VFS")));
+}
+
+/* Open a connection whose main database lives in store */
+sqlite3 *
+sqlite_vfs_open_db(sqlite_PageStore *store, bool readonly)
+{
+	sqlite3 *db = NULL;
+	StringInfoData config;
+	char *msg = NULL;
+	int rc;
+
+	LOGF();
+
+	sqlite_vfs_pending = store;
+	rc = sqlite3_open_v2("main.db", &db,
+						 readonly ? SQLITE_OPEN_READONLY :
+						 SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+						 SQLITE_VFS_NAME);
+
+	/* The main database must have been opened on the store */
+	if (rc == SQLITE_OK && sqlite_vfs_pending != NULL)
+		rc = SQLITE_CANTOPEN;
+	sqlite_vfs_pending = NULL;
+
+	if (rc != SQLITE_OK)
+	{
+		char *err = pstrdup(db ? sqlite3_errmsg(db) : sqlite3_errstr(rc));
+
+		sqlite3_close(db);
+		ereport(ERROR, (errmsg("Failed to create SQLite in-memory database: %s", err)));
+	}
+
+	/* Worker threads would allocate from the SQLite context from
+	   another thread */
+	sqlite3_limit(db, SQLITE_LIMIT_WORKER_THREADS, 0);
+
+	/* Journals and temp storage stay in memory, no named file can be
+	   opened next to the store, and no other connection ever shares
+	   it.  A negative cache_size is the page cache limit in kB, half
+	   of what the database may use in all. */
+	initStringInfo(&config);
+	appendStringInfoString(&config,
+						   "PRAGMA journal_mode=MEMORY;"
+						   "PRAGMA temp_store=MEMORY;"
+						   "PRAGMA locking_mode=EXCLUSIVE;");
+	if (sqlite_max_memory_per_db > 0)
+		appendStringInfo(&config, "PRAGMA cache_size=-%d;", Max(sqlite_max_memory_per_db / 2, 1));
+
+	if (sqlite3_exec(db, config.data, NULL, NULL, &msg) != SQLITE_OK)
+	{
+		char *err = pstrdup(msg ? msg : sqlite3_errmsg(db));
+
+		sqlite3_free(msg);
+		sqlite3_close(db);
+		ereport(ERROR, (errmsg("Failed to configure SQLite database: %s", err)));
+	}
+	pfree(config.data);
+	return db;
+}
+
+/* Local Variables: */
+/* mode: c */
+/* c-file-style: "postgresql" */
+/* End: */
@@ -0,0 +1,52 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE agg_events (tenant int, id int, name text, score float8, ok bool, data bytea, amount numeric);
+INSERT INTO agg_events
+    SELECT i % 3, i, 'event ' || i, i / 4.0, i % 2 = 0, int4send(i), i * 1.25
+    FROM generate_series(1, 30) i;
+INSERT INTO agg_events VALUES (3, NULL, NULL, NULL, NULL, NULL, NULL);
+
+-- Each attribute becomes a column with the affinity of its type
+SELECT * FROM sqlite_query((SELECT sqlite_agg('events', e) FROM agg_events e),
+    'SELECT name, type FROM pragma_table_info(''events'') ORDER BY cid') AS (name text, type text);
+
+-- One database per group, whether grouped by sorting or hashing
+SET enable_hashagg = off;
+SELECT tenant, q.* FROM (SELECT tenant, sqlite_agg('events', e) AS db FROM agg_events e GROUP BY tenant) g,
+    sqlite_query(db, 'SELECT count(*), count(id), sum(id), sum(amount), sum(ok) FROM events')
+    AS q(n int, ids int, sum int, amount numeric, ok int)
+    ORDER BY tenant;
+RESET enable_hashagg;
+SET enable_sort = off;
+SELECT tenant, q.* FROM (SELECT tenant, sqlite_agg('events', e) AS db FROM agg_events e GROUP BY tenant) g,
+    sqlite_query(db, 'SELECT count(*), sum(id) FROM events') AS q(n int, sum int)
+    ORDER BY tenant;
+RESET enable_sort;
+
+-- Rows can go to several tables, in the same group or interleaved across groups
+SELECT * FROM sqlite_query(
+    (SELECT sqlite_agg(tbl, r) FROM (VALUES ('a', ROW(1, 2)), ('b', ROW(3, 4)), ('a', ROW(5, 6))) v(tbl, r)),
+    'SELECT ''a'', count(*), sum(f1) FROM a UNION ALL SELECT ''b'', count(*), sum(f1) FROM b')
+    AS (tbl text, n int, sum int);
+SET enable_sort = off;
+SELECT g, q.* FROM (
+    SELECT g, sqlite_agg(tbl, r) AS db
+    FROM (VALUES (1, 'a', ROW(1)), (2, 'b', ROW(2)), (1, 'b', ROW(3)), (2, 'a', ROW(4)), (1, 'a', ROW(5))) v(g, tbl, r)
+    GROUP BY g) d,
+    sqlite_query(db, 'SELECT (SELECT group_concat(f1) FROM a), (SELECT group_concat(f1) FROM b)') AS q(a text, b text)
+    ORDER BY g;
+RESET enable_sort;
+
+-- A row type that changes within a table must still fit it
+SELECT sqlite_agg('t', r) FROM (VALUES (ROW(1, 2)), (ROW(3, 'x'::text, 5))) v(r);
+
+-- NULL rows are skipped, a NULL table is an error
+SELECT * FROM sqlite_query(
+    (SELECT sqlite_agg('t', r) FROM (VALUES (ROW(1)), (NULL), (ROW(2))) v(r)),
+    'SELECT count(*) FROM t') AS (n int);
+SELECT sqlite_agg(NULL, ROW(1));
+SELECT sqlite_agg('t', r) IS NULL FROM (VALUES (NULL::record)) v(r);
+
+DROP TABLE agg_events;
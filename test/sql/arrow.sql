@@ -0,0 +1,199 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- A little reader of the Arrow IPC stream format: each message is a
+-- continuation marker, the length of its metadata, the flatbuffer
+-- Message and its body; the stream ends with a message of length 0.
+-- The array buffers of a record batch are little-endian.
+
+-- Little-endian integers
+CREATE FUNCTION arrow_uint(b bytea, pos int, len int) RETURNS bigint
+LANGUAGE sql IMMUTABLE STRICT AS $$
+	SELECT sum(get_byte(b, pos + i)::bigint << (8 * i))::bigint
+	  FROM generate_series(0, len - 1) i
+$$;
+
+CREATE FUNCTION arrow_float8(b bytea, pos int) RETURNS float8
+LANGUAGE sql IMMUTABLE STRICT AS $$
+	SELECT CASE WHEN e = 0 THEN 0 ELSE (1 - 2 * s) * (1 + m / 2 ^ 52) * 2 ^ (e - 1023) END
+	  FROM (SELECT (bits >> 63) & 1 AS s, (bits >> 52) & 2047 AS e, bits & 4503599627370495 AS m
+	          FROM (SELECT arrow_uint(b, pos, 8) AS bits) b) f
+$$;
+
+CREATE FUNCTION arrow_int32(b bytea, pos int) RETURNS int
+LANGUAGE sql IMMUTABLE STRICT AS $$
+	SELECT (arrow_uint(b, pos, 4) - CASE WHEN get_byte(b, pos + 3) >= 128 THEN 4294967296 ELSE 0 END)::int
+$$;
+
+-- The position of field n of the flatbuffer table at tbl, or NULL if
+-- the field is absent
+CREATE FUNCTION arrow_field(b bytea, tbl int, n int) RETURNS int
+LANGUAGE plpgsql IMMUTABLE STRICT AS $$
+DECLARE
+	vt int := tbl - arrow_int32(b, tbl);
+	off int;
+BEGIN
+	IF 4 + 2 * n >= arrow_uint(b, vt, 2) THEN
+		RETURN NULL;
+	END IF;
+	off := arrow_uint(b, vt + 4 + 2 * n, 2);
+	RETURN CASE WHEN off = 0 THEN NULL ELSE tbl + off END;
+END
+$$;
+
+-- Follows the offset at pos to a table, vector or string
+CREATE FUNCTION arrow_ref(b bytea, pos int) RETURNS int
+LANGUAGE sql IMMUTABLE STRICT AS $$
+	SELECT pos + arrow_uint(b, pos, 4)::int
+$$;
+
+CREATE FUNCTION arrow_messages(stream bytea)
+RETURNS TABLE (message text, num_rows bigint, body_length bigint, header int, body int)
+LANGUAGE plpgsql AS $$
+DECLARE
+	pos int := 0;
+	metalen int;
+	msg int;
+	hdr int;
+	fields int;
+	field int;
+	name int;
+	types text[] := ARRAY['null', 'int', 'float', 'binary', 'utf8'];
+BEGIN
+	LOOP
+		IF arrow_uint(stream, pos, 4) <> 4294967295 THEN
+			RAISE EXCEPTION 'no continuation marker at %', pos;
+		END IF;
+		metalen := arrow_uint(stream, pos + 4, 4);
+		pos := pos + 8;
+		IF metalen = 0 THEN
+			IF pos <> length(stream) THEN
+				RAISE EXCEPTION '% bytes after the end of the stream', length(stream) - pos;
+			END IF;
+			message := 'end';
+			num_rows := NULL;
+			body_length := NULL;
+			header := NULL;
+			body := NULL;
+			RETURN NEXT;
+			RETURN;
+		END IF;
+		IF pos % 8 <> 0 OR metalen % 8 <> 0 THEN
+			RAISE EXCEPTION 'metadata at % is not aligned', pos;
+		END IF;
+
+		msg := arrow_ref(stream, pos);
+		hdr := arrow_ref(stream, arrow_field(stream, msg, 2));
+		header := hdr;
+		body := pos + metalen;
+		body_length := coalesce(arrow_uint(stream, arrow_field(stream, msg, 3), 8), 0);
+		CASE get_byte(stream, arrow_field(stream, msg, 1))
+			WHEN 1 THEN
+				fields := arrow_ref(stream, arrow_field(stream, hdr, 1));
+				message := 'schema:';
+				FOR i IN 0 .. arrow_uint(stream, fields, 4) - 1 LOOP
+					field := arrow_ref(stream, fields + 4 + 4 * i);
+					name := arrow_ref(stream, arrow_field(stream, field, 0));
+					message := message || ' ' ||
+						convert_from(substr(stream, name + 5, arrow_uint(stream, name, 4)::int), 'UTF8') || ' ' ||
+						types[get_byte(stream, arrow_field(stream, field, 2))];
+				END LOOP;
+				num_rows := NULL;
+			WHEN 3 THEN
+				message := 'record batch';
+				num_rows := arrow_uint(stream, arrow_field(stream, hdr, 0), 8);
+			ELSE
+				message := 'message ' || get_byte(stream, arrow_field(stream, msg, 1));
+				num_rows := NULL;
+		END CASE;
+		RETURN NEXT;
+		pos := pos + metalen + body_length;
+		IF pos > length(stream) THEN
+			RAISE EXCEPTION 'message body runs past the end of the stream';
+		END IF;
+	END LOOP;
+END
+$$;
+
+-- The values of column col of the record batch at header with its body
+-- at body, the columns being of types
+CREATE FUNCTION arrow_column(b bytea, header int, body int, types text[], col int)
+RETURNS TABLE (rownum int, value text)
+LANGUAGE plpgsql AS $$
+DECLARE
+	nodes int := arrow_ref(b, arrow_field(b, header, 1)) + 4 + 16 * col;
+	buffers int := arrow_ref(b, arrow_field(b, header, 2)) + 4;
+	len int := arrow_uint(b, nodes, 8);
+	validity int;
+	validity_len int;
+	offsets int;
+	data int;
+	first int;
+	last int;
+BEGIN
+	FOR i IN 1 .. col LOOP
+		buffers := buffers + 16 * CASE WHEN types[i] IN ('utf8', 'binary') THEN 3 ELSE 2 END;
+	END LOOP;
+	validity := body + arrow_uint(b, buffers, 8);
+	validity_len := arrow_uint(b, buffers + 8, 8);
+	IF types[col + 1] IN ('utf8', 'binary') THEN
+		offsets := body + arrow_uint(b, buffers + 16, 8);
+		buffers := buffers + 16;
+	END IF;
+	data := body + arrow_uint(b, buffers + 16, 8);
+
+	FOR r IN 0 .. len - 1 LOOP
+		rownum := r;
+		IF validity_len > 0 AND get_byte(b, validity + r / 8) & (1 << (r % 8)) = 0 THEN
+			value := NULL;
+		ELSIF types[col + 1] = 'int' THEN
+			value := arrow_uint(b, data + 8 * r, 8)::text;
+		ELSIF types[col + 1] = 'float' THEN
+			value := arrow_float8(b, data + 8 * r)::text;
+		ELSE
+			first := arrow_int32(b, offsets + 4 * r);
+			last := arrow_int32(b, offsets + 4 * r + 4);
+			value := CASE types[col + 1]
+				WHEN 'utf8' THEN convert_from(substr(b, data + first + 1, last - first), 'UTF8')
+				ELSE encode(substr(b, data + first + 1, last - first), 'hex')
+			END;
+		END IF;
+		RETURN NEXT;
+	END LOOP;
+END
+$$;
+
+CREATE TABLE arrow AS SELECT sqlite_exec('',
+    'CREATE TABLE t(i INTEGER, f REAL, s TEXT, b BLOB);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 1000)
+     INSERT INTO t SELECT v - 500, v / 4.0 - 100, CASE WHEN v % 2 = 0 THEN ''row '' || v END,
+                          CASE WHEN v % 3 > 0 THEN substr(x''ff017f'', v % 3) END FROM c') AS db;
+
+SELECT message, num_rows, body_length FROM arrow, arrow_messages(sqlite_to_arrow(db, 'SELECT i, f, s, b FROM t', 300)) m;
+SELECT count(*) AS batches, sum(num_rows) AS num_rows
+  FROM arrow, arrow_messages(sqlite_to_arrow(db, 'SELECT i, s FROM t', 64)) m
+ WHERE message = 'record batch';
+SELECT message, num_rows, body_length FROM arrow, arrow_messages(sqlite_to_arrow(db, 'SELECT i FROM t WHERE i < 0')) m;
+SELECT message, num_rows, body_length FROM arrow, arrow_messages(sqlite_to_arrow(db, 'SELECT count(*) AS n FROM t', 1)) m;
+
+-- The values of every batch read back
+CREATE TABLE arrow_values AS
+SELECT (m.n - 2) * 300 + c.rownum AS rownum, col, c.value
+  FROM arrow,
+       LATERAL (SELECT sqlite_to_arrow(db, 'SELECT i, f, s, b FROM t ORDER BY rowid', 300) AS stream) s,
+       arrow_messages(s.stream) WITH ORDINALITY m(message, num_rows, body_length, header, body, n),
+       generate_series(0, 3) col,
+       arrow_column(s.stream, m.header, m.body, ARRAY['int', 'float', 'utf8', 'binary'], col) c
+ WHERE m.message = 'record batch';
+SELECT rownum, array_agg(value ORDER BY col) FROM arrow_values WHERE rownum IN (0, 1, 2, 299, 300, 999) GROUP BY rownum ORDER BY rownum;
+SELECT count(*) AS rows, count(*) FILTER (WHERE ARRAY[i::text, f::text, s, encode(b, 'hex')] IS DISTINCT FROM v) AS wrong
+  FROM arrow, sqlite_query(db, 'SELECT rowid - 1, i, f, s, b FROM t') AS q(rownum int, i bigint, f float8, s text, b bytea)
+  LEFT JOIN (SELECT rownum, array_agg(value ORDER BY col) AS v FROM arrow_values GROUP BY rownum) a USING (rownum);
+
+SELECT sqlite_to_arrow(db, 'SELECT i FROM t', 0) FROM arrow;
+SELECT sqlite_to_arrow(db, 'CREATE TABLE u(x)') FROM arrow;
+
+DROP TABLE arrow, arrow_values;
+DROP FUNCTION arrow_column(bytea, int, int, text[], int), arrow_messages(bytea), arrow_ref(bytea, int), arrow_field(bytea, int, int),
+              arrow_int32(bytea, int), arrow_float8(bytea, int), arrow_uint(bytea, int, int);
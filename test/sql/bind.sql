@@ -0,0 +1,34 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- Values bind by position
+SELECT * FROM sqlite_query('', 'SELECT ?, ?, ?, ?, ?', 1, 2.5::float8, 'three', '\x04'::bytea, NULL::int)
+    AS (a int, b float8, c text, d bytea, e int);
+SELECT * FROM sqlite_query('', 'SELECT typeof(?), typeof(?), typeof(?), typeof(?), typeof(?)',
+                           1::bigint, true, 1.5::float4, '\x00'::bytea, now()::date)
+    AS (a text, b text, c text, d text, e text);
+
+-- Named parameters are numbered in the order they first appear
+SELECT * FROM sqlite_query('', 'SELECT :a, @b, :a, $c', 1, 2, 3) AS (a int, b int, c int, d int);
+SELECT * FROM sqlite_query('', 'SELECT ?2, ?1', 1, 2) AS (a int, b int);
+
+-- VARIADIC passes all values as one array
+SELECT * FROM sqlite_query('', 'SELECT ? + ?', VARIADIC ARRAY[20, 22]) AS (a int);
+SELECT * FROM sqlite_query('', 'SELECT 1', VARIADIC ARRAY[]::int[]) AS (a int);
+
+-- Every parameter needs a value and every value a parameter
+SELECT * FROM sqlite_query('', 'SELECT ?, ?', 1) AS (a int, b int);
+SELECT * FROM sqlite_query('', 'SELECT ?', 1, 2) AS (a int);
+SELECT * FROM sqlite_query('', 'SELECT 1', 1) AS (a int);
+SELECT * FROM sqlite_query_columns('', 'SELECT ?', 1, 2) AS (a int[]);
+
+-- The statements of sqlite_exec() share the values
+SELECT * FROM sqlite_query(
+    sqlite_exec('', 'CREATE TABLE t(x); INSERT INTO t VALUES (?); INSERT INTO t VALUES (?1 + ?2)', 5, 6),
+    'SELECT x FROM t ORDER BY x') AS (x int);
+SELECT sqlite_exec('', 'CREATE TABLE t(x); INSERT INTO t VALUES (?)', 5, 6);
+
+-- A cached statement is bound again when reused
+SELECT * FROM sqlite_query('', 'SELECT ?', 'first') AS (a text);
+SELECT * FROM sqlite_query('', 'SELECT ?', NULL::text) AS (a text);
@@ -0,0 +1,54 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- Stored out of line and uncompressed, below the lazy load threshold
+CREATE TABLE cache (id int, db sqlite);
+ALTER TABLE cache ALTER db SET STORAGE external;
+INSERT INTO cache SELECT id, sqlite_exec('',
+    'CREATE TABLE t(i INTEGER PRIMARY KEY, s TEXT);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 2000)
+     INSERT INTO t SELECT v, printf(''%050d'', v) FROM c')
+  FROM generate_series(1, 2) id;
+
+-- Statistics of the statement cache of the connection a stored
+-- database is expanded into, which shows whether it was reused
+CREATE FUNCTION cache_stats(id int) RETURNS text LANGUAGE sql AS $$
+    SELECT format('hits %s, misses %s', hits, misses)
+      FROM sqlite_stmt_cache_stats((SELECT db FROM cache WHERE cache.id = cache_stats.id))
+$$;
+
+CREATE FUNCTION cache_query(id int) RETURNS bigint LANGUAGE sql AS $$
+    SELECT sum(i) FROM cache, sqlite_query(db, 'SELECT i FROM t') AS (i int) WHERE cache.id = cache_query.id
+$$;
+
+-- Queries in separate statements share the cached connection
+SELECT cache_query(1);
+SELECT cache_query(1);
+SELECT cache_stats(1);
+
+-- Both databases fit
+SELECT cache_query(2);
+SELECT cache_stats(1), cache_stats(2);
+
+-- Only one does: the one used is kept and the other evicted, and
+-- expanding that one again evicts the first
+SET sqlite.cache_size = '200kB';
+SELECT cache_query(1);
+SELECT cache_stats(1);
+SELECT cache_stats(2);
+SELECT cache_stats(1);
+
+-- Without a cache every statement expands the database again
+SET sqlite.cache_size = 0;
+SELECT cache_query(1);
+SELECT cache_stats(1);
+RESET sqlite.cache_size;
+
+-- A changed database is a new TOAST value
+UPDATE cache SET db = sqlite_exec(db, 'DELETE FROM t WHERE i > 1000') WHERE id = 1;
+SELECT cache_query(1);
+SELECT cache_stats(1);
+
+DROP TABLE cache;
+DROP FUNCTION cache_stats(int), cache_query(int);
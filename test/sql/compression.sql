@@ -0,0 +1,43 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- Without TOAST compression, so the sizes show the page compression
+CREATE TABLE compression (id int, db sqlite);
+ALTER TABLE compression ALTER db SET STORAGE external;
+
+CREATE FUNCTION compression_summary(db sqlite) RETURNS text LANGUAGE sql AS $$
+    SELECT format('%s rows, sum %s, %s', n, s, h)
+      FROM sqlite_query(db, 'SELECT count(*), sum(i), sum(length(s)) + sum(length(b)) FROM t')
+        AS (n int, s bigint, h bigint)
+$$;
+
+INSERT INTO compression VALUES (1, sqlite_exec('',
+    'CREATE TABLE t(i INTEGER PRIMARY KEY, r REAL, s TEXT, b BLOB);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 20000)
+     INSERT INTO t SELECT v, v / 7.0, ''row '' || v, zeroblob(v % 5) FROM c'));
+
+-- Compressed pages, read in place and changed
+SET sqlite.compression = pglz;
+INSERT INTO compression SELECT 2, sqlite_exec(db, 'UPDATE t SET s = upper(s) WHERE i % 3 = 0')
+  FROM compression WHERE id = 1;
+SELECT id, pg_column_size(db) < length(sqlite_serialize(db)) / 2 AS compressed
+  FROM compression ORDER BY id;
+SELECT compression_summary(db),
+       (SELECT count(*) FROM sqlite_query(db, 'SELECT s FROM t WHERE s GLOB ''ROW*''') AS (s text))
+  FROM compression WHERE id = 2;
+UPDATE compression SET db = sqlite_exec(db, 'DELETE FROM t WHERE i > 10000') WHERE id = 2;
+SELECT compression_summary(db) FROM compression WHERE id = 2;
+SELECT compression_summary(sqlite_deserialize(sqlite_serialize(db))) FROM compression WHERE id = 2;
+SELECT compression_summary(db::text::sqlite) FROM compression WHERE id = 2;
+
+-- Uncompressed again
+SET sqlite.compression = none;
+UPDATE compression SET db = sqlite_exec(db, 'INSERT INTO t(s) VALUES (''last'')') WHERE id = 2;
+SELECT compression_summary(db) FROM compression WHERE id = 2;
+SELECT id, pg_column_size(db) < length(sqlite_serialize(db)) / 2 AS compressed
+  FROM compression ORDER BY id;
+RESET sqlite.compression;
+
+DROP TABLE compression;
+DROP FUNCTION compression_summary(sqlite);
@@ -0,0 +1,52 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- Integers
+SELECT * FROM sqlite_query('', 'SELECT 32767, -2147483648, 9223372036854775807, 0, 2')
+    AS (a int2, b int4, c int8, d bool, e bool);
+SELECT * FROM sqlite_query('', 'SELECT 32768') AS (a int2);
+SELECT * FROM sqlite_query('', 'SELECT -32769') AS (a int2);
+SELECT * FROM sqlite_query('', 'SELECT 2147483648') AS (a int4);
+SELECT * FROM sqlite_query('', 'SELECT 9223372036854775807 + 1') AS (a int8);
+
+-- Storage classes that don't convert
+SELECT * FROM sqlite_query('', 'SELECT ''42''') AS (a int4);
+SELECT * FROM sqlite_query('', 'SELECT 4.2') AS (a int8);
+SELECT * FROM sqlite_query('', 'SELECT x''00''') AS (a text);
+SELECT * FROM sqlite_query('', 'SELECT ''t''') AS (a bool);
+SELECT * FROM sqlite_query('', 'SELECT 1.5') AS (a bytea);
+SELECT * FROM sqlite_query('', 'SELECT x''01''') AS (a float8);
+
+-- Floating point and numeric
+SELECT * FROM sqlite_query('', 'SELECT 1.5, 3, 1e300, 2.25, 7, ''1.005''')
+    AS (a float4, b float8, c float8, d numeric, e numeric(4, 1), f numeric(4, 2));
+SELECT * FROM sqlite_query('', 'SELECT 1e300') AS (a float4);
+SELECT * FROM sqlite_query('', 'SELECT 12345') AS (a numeric(4, 1));
+
+-- Text and blobs
+SELECT * FROM sqlite_query('', 'SELECT ''héllo'', 12, 1.5, ''abc'', x''00ff''')
+    AS (a text, b text, c varchar(3), d bytea, e bytea);
+SELECT * FROM sqlite_query('', 'SELECT ''abcd''') AS (a varchar(3));
+SELECT * FROM sqlite_query('', 'SELECT CAST(x''61006263'' AS TEXT)') AS (a text);
+SELECT * FROM sqlite_query('', 'SELECT CAST(x''61ff62'' AS TEXT)') AS (a text);
+
+-- Dates and times are UTC, whatever the session's zone
+SET TimeZone = 'America/New_York';
+SELECT * FROM sqlite_query('',
+    'SELECT ''2024-03-01 12:34:56'', ''2024-03-01 12:34:56'', ''2024-03-01T12:34:56.5+02:00'', ''2024-03-01 12:34:56+02:00''')
+    AS (a timestamp, b timestamptz, c timestamptz, d timestamp);
+SELECT * FROM sqlite_query('', 'SELECT 0, 1700000000, 2440587.5, julianday(''2024-03-01 12:00'')')
+    AS (a timestamptz, b timestamptz, c timestamp, d timestamp);
+SELECT * FROM sqlite_query('', 'SELECT ''2024-03-01 12:34:56.789'', ''infinity''') AS (a timestamp(1), b timestamptz);
+SELECT * FROM sqlite_query('', 'SELECT ''yesterday-ish''') AS (a timestamp);
+SELECT * FROM sqlite_query('', 'SELECT 9223372036854775807') AS (a timestamptz);
+SELECT * FROM sqlite_query('', 'SELECT x''00''') AS (a timestamp);
+RESET TimeZone;
+
+-- Other types go through their input function
+SELECT * FROM sqlite_query('', 'SELECT ''2024-03-01'', ''{1,2}'', ''{"a": 1}'', 42') AS (a date, b int[], c jsonb, d text);
+SELECT * FROM sqlite_query('', 'SELECT ''not a date''') AS (a date);
+
+-- NULL converts to NULL for any type
+SELECT * FROM sqlite_query('', 'SELECT NULL, NULL, NULL, NULL') AS (a int2, b text, c timestamptz, d bytea);
@@ -0,0 +1,37 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE dump_dbs (id int, db sqlite);
+INSERT INTO dump_dbs VALUES (1, sqlite_exec('', $$
+    CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, data BLOB);
+    CREATE INDEX t_name ON t(name);
+    INSERT INTO t VALUES (1, 'one', x'01'), (2, 'it''s', NULL);
+    CREATE TABLE u(x);
+    INSERT INTO u VALUES (1.5);
+    CREATE VIEW v AS SELECT name FROM t;
+$$));
+
+-- The whole database, one statement per row
+SELECT rtrim(d, E'\n') FROM sqlite_dump((SELECT db FROM dump_dbs)) d;
+SELECT rtrim(d, E'\n') FROM sqlite_dump((SELECT db FROM dump_dbs), NULL) d;
+
+-- One table with its indexes and views
+SELECT rtrim(d, E'\n') FROM sqlite_dump((SELECT db FROM dump_dbs), 't') d;
+SELECT rtrim(d, E'\n') FROM sqlite_dump((SELECT db FROM dump_dbs), 'U') d;
+SELECT rtrim(d, E'\n') FROM sqlite_dump((SELECT db FROM dump_dbs), 'missing') d;
+SELECT count(*) FROM sqlite_dump(NULL);
+
+-- The dump restores to the same database
+SELECT * FROM sqlite_query(
+    sqlite_exec('', (SELECT string_agg(d, '') FROM sqlite_dump((SELECT db FROM dump_dbs)) d)),
+    'SELECT id, name, data FROM t ORDER BY id') AS (id int, name text, data bytea);
+
+-- Text that isn't valid in the database encoding is refused, and the
+-- database can be dumped again afterwards
+UPDATE dump_dbs SET db = sqlite_exec(db, 'INSERT INTO u VALUES (CAST(x''61ff'' AS TEXT))');
+SELECT rtrim(d, E'\n') FROM sqlite_dump((SELECT db FROM dump_dbs), 'u') d;
+UPDATE dump_dbs SET db = sqlite_exec(db, 'DELETE FROM u WHERE typeof(x) = ''text''');
+SELECT rtrim(d, E'\n') FROM sqlite_dump((SELECT db FROM dump_dbs), 'u') d;
+
+DROP TABLE dump_dbs;
@@ -0,0 +1,56 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- The row estimate of the top node of the plan of a query
+CREATE FUNCTION estimate_rows(query text) RETURNS int LANGUAGE plpgsql AS $$
+DECLARE
+    line text;
+BEGIN
+    EXECUTE 'EXPLAIN ' || query INTO line;
+    RETURN substring(line FROM 'rows=(\d+)')::int;
+END
+$$;
+
+CREATE TABLE estimate_dbs (id int, db sqlite);
+INSERT INTO estimate_dbs VALUES (1, sqlite_exec('', $$
+    CREATE TABLE t(id INTEGER PRIMARY KEY, k INTEGER, v TEXT);
+    CREATE INDEX t_k ON t(k);
+    CREATE TABLE u(id INTEGER, w TEXT);
+    WITH RECURSIVE s(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM s WHERE i < 500)
+    INSERT INTO t SELECT i, i % 50, 'v' || i FROM s;
+    INSERT INTO u SELECT id, v FROM t WHERE id <= 20;
+$$));
+
+-- Without sqlite_stat1 every query is sqlite.query_rows
+SELECT db::text AS plain FROM estimate_dbs \gset
+SELECT q, estimate_rows(format('SELECT * FROM sqlite_query(%L, %L) AS (a int)', :'plain', q))
+    FROM unnest(ARRAY['SELECT id FROM t', 'SELECT id FROM t WHERE k = 5', 'SELECT 1']) q;
+SET sqlite.query_rows = 42;
+SELECT estimate_rows(format('SELECT * FROM sqlite_query(%L, %L) AS (a int)', :'plain', 'SELECT id FROM t'));
+RESET sqlite.query_rows;
+
+-- With it, from the plan SQLite makes for the query
+UPDATE estimate_dbs SET db = sqlite_exec(db, 'ANALYZE');
+SELECT db::text AS analyzed FROM estimate_dbs \gset
+SELECT q, estimate_rows(format('SELECT * FROM sqlite_query(%L, %L) AS (a int)', :'analyzed', q))
+    FROM unnest(ARRAY[
+        'SELECT id FROM t',
+        'SELECT id FROM t WHERE k = 5',
+        'SELECT id FROM t WHERE k > 5',
+        'SELECT id FROM t WHERE id = 5',
+        'SELECT t.id FROM u JOIN t ON t.k = u.id',
+        'SELECT 1']) q;
+
+-- Constant parameters are planned with their values
+SELECT estimate_rows(format('SELECT * FROM sqlite_query(%L, %L, 5) AS (a int)', :'analyzed', 'SELECT id FROM t WHERE k = ?'));
+
+-- A database or query only known at run time gets sqlite.query_rows
+SELECT estimate_rows('SELECT * FROM sqlite_query((SELECT db FROM estimate_dbs), ''SELECT id FROM t'') AS (a int)');
+SELECT estimate_rows(format('SELECT * FROM sqlite_query(%L, (SELECT ''SELECT id FROM t'')) AS (a int)', :'analyzed'));
+
+-- A query that doesn't prepare is left for the executor to report
+SELECT estimate_rows(format('SELECT * FROM sqlite_query(%L, %L) AS (a int)', :'analyzed', 'SELECT * FROM missing'));
+
+DROP TABLE estimate_dbs;
+DROP FUNCTION estimate_rows(text);
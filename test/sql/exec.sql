@@ -0,0 +1,36 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE exec_dbs (id int, db sqlite);
+ALTER TABLE exec_dbs ALTER COLUMN db SET STORAGE external;
+INSERT INTO exec_dbs VALUES (1, sqlite_exec('', 'CREATE TABLE t(x); WITH RECURSIVE s(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM s WHERE i < 1000) INSERT INTO t SELECT i FROM s'));
+
+-- The TOAST value a stored database is kept in
+CREATE FUNCTION exec_chunk_id() RETURNS oid LANGUAGE plpgsql AS $$
+DECLARE
+    result oid;
+BEGIN
+    EXECUTE format('SELECT chunk_id FROM %s LIMIT 1',
+                   (SELECT reltoastrelid::regclass FROM pg_class WHERE oid = 'exec_dbs'::regclass))
+        INTO result;
+    RETURN result;
+END
+$$;
+CREATE TEMP TABLE exec_chunks AS SELECT exec_chunk_id() AS chunk_id;
+
+-- Statements that change nothing return the database as it came in, so
+-- it is written back as the same TOAST value
+UPDATE exec_dbs SET db = sqlite_exec(db, 'SELECT count(*) FROM t');
+UPDATE exec_dbs SET db = sqlite_exec(db, 'UPDATE t SET x = 0 WHERE x < 0; DELETE FROM t WHERE x > ?', 5000);
+UPDATE exec_dbs SET db = sqlite_exec(db, 'BEGIN; INSERT INTO t VALUES (0); ROLLBACK');
+SELECT exec_chunk_id() = chunk_id AS same FROM exec_chunks;
+
+-- A write returns a new database
+UPDATE exec_dbs SET db = sqlite_exec(db, 'SELECT 1; UPDATE t SET x = -x WHERE x = 1');
+SELECT exec_chunk_id() = chunk_id AS same FROM exec_chunks;
+SELECT * FROM sqlite_query((SELECT db FROM exec_dbs), 'SELECT count(*), min(x) FROM t') AS (n int, min int);
+
+DROP TABLE exec_dbs;
+DROP TABLE exec_chunks;
+DROP FUNCTION exec_chunk_id();
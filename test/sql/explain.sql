@@ -0,0 +1,54 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE explain_dbs (id int, db sqlite);
+INSERT INTO explain_dbs VALUES (1, sqlite_exec('', $$
+    CREATE TABLE t(id INTEGER PRIMARY KEY, k INTEGER, v TEXT);
+    CREATE INDEX t_k ON t(k);
+    CREATE TABLE u(id INTEGER, w TEXT);
+    WITH RECURSIVE s(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM s WHERE i < 100)
+    INSERT INTO t SELECT i, i % 10, 'v' || i FROM s;
+    INSERT INTO u SELECT id, v FROM t WHERE id <= 20;
+$$));
+
+-- The plan, children indented below their parents
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), 'SELECT * FROM t WHERE id = 5');
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), 'SELECT * FROM t WHERE k = 5');
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), 'SELECT v FROM t ORDER BY v');
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs),
+    'SELECT k, count(*) FROM t WHERE id IN (SELECT id FROM u WHERE w LIKE ''v1%'') GROUP BY k');
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs),
+    'SELECT 1 UNION ALL SELECT * FROM (SELECT k FROM t LIMIT 1)');
+
+-- Analyze runs the query and reports its counters, the memory used and
+-- the time taken vary and are left out here
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), 'SELECT v FROM t ORDER BY v', true) AS e(line)
+    WHERE line !~ '^(Memory Used|Execution Time|VM Steps):';
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), 'SELECT * FROM t JOIN u ON u.w = t.v', true) AS e(line)
+    WHERE line !~ '^(Memory Used|Execution Time|VM Steps):';
+SELECT count(*) FROM sqlite_explain((SELECT db FROM explain_dbs), 'SELECT 1', true) AS e(line)
+    WHERE line ~ '^(Memory Used: \d+ bytes|Execution Time: [\d.]+ ms|VM Steps: \d+)$';
+
+-- A cached statement's counters only cover the analyzed run
+SELECT * FROM sqlite_query((SELECT db FROM explain_dbs), 'SELECT count(*) FROM t WHERE v > ''''') AS (n int);
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), 'SELECT count(*) FROM t WHERE v > ''''', true) AS e(line)
+    WHERE line ~ '^(Rows|Full Scan Steps):';
+
+-- Writes can be explained but not analyzed, which would change the database
+SELECT * FROM sqlite_explain(sqlite_exec('', 'CREATE TABLE t(k); CREATE INDEX t_k ON t(k)'), 'DELETE FROM t WHERE k = 1');
+SELECT * FROM sqlite_explain(sqlite_exec('', 'CREATE TABLE t(k)'), 'DELETE FROM t WHERE k = 1', true);
+SELECT * FROM sqlite_explain(sqlite_exec('', 'CREATE TABLE t(k)'), 'INSERT INTO t VALUES (1) RETURNING k', true);
+SELECT * FROM sqlite_explain(sqlite_exec('', 'CREATE TABLE t(k)'), 'CREATE TABLE x(y)', true);
+SELECT * FROM sqlite_explain(sqlite_exec('', 'CREATE TABLE t(k)'), 'BEGIN', true);
+SELECT * FROM sqlite_explain(sqlite_exec('', 'CREATE TABLE t(k)'), 'PRAGMA user_version = 1', true);
+
+-- A stored database can't even prepare a write
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), 'DELETE FROM t WHERE k = 1');
+
+-- Errors and empty queries
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), 'SELECT * FROM missing');
+SELECT * FROM sqlite_explain((SELECT db FROM explain_dbs), '');
+SELECT * FROM sqlite_explain(NULL, 'SELECT 1');
+
+DROP TABLE explain_dbs;
@@ -0,0 +1,25 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- Without TOAST compression, so the stored size is that of the image
+CREATE TABLE flatten (id int, db sqlite);
+ALTER TABLE flatten ALTER db SET STORAGE external;
+
+-- A changed database is stored as its plain image
+INSERT INTO flatten VALUES (1, sqlite_exec('',
+    'CREATE TABLE t(i INTEGER PRIMARY KEY, s TEXT);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 5000)
+     INSERT INTO t SELECT v, ''row '' || v FROM c'));
+INSERT INTO flatten SELECT 2, sqlite_deserialize(sqlite_serialize(db)) FROM flatten WHERE id = 1;
+UPDATE flatten SET db = sqlite_exec(db, 'UPDATE t SET s = ''changed'' WHERE i = 1') WHERE id = 2;
+SELECT id, pg_column_size(db) - length(sqlite_serialize(db)) AS header, q.*
+  FROM flatten, sqlite_query(db, 'SELECT count(*), max(s) FROM t') AS q(n int, s text)
+ ORDER BY id;
+
+-- A database can't be stored with a transaction open
+INSERT INTO flatten VALUES (3, sqlite_exec('', 'BEGIN; CREATE TABLE t(x)'));
+INSERT INTO flatten VALUES (3, sqlite_exec(sqlite_exec('', 'BEGIN; CREATE TABLE t(x)'), 'COMMIT'));
+SELECT id, db FROM flatten WHERE id = 3;
+
+DROP TABLE flatten;
@@ -0,0 +1,49 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TYPE insert_row AS (id int, name text, score float8, data bytea);
+CREATE TABLE insert_dbs (id int, db sqlite);
+INSERT INTO insert_dbs VALUES (1, sqlite_exec('', 'CREATE TABLE t(id INTEGER, name TEXT, score REAL, data BLOB); CREATE TABLE s(x)'));
+
+-- Rows of a composite type bind one attribute per column, NULLs included
+UPDATE insert_dbs SET db = sqlite_insert(db, 't', ARRAY[
+    ROW(1, 'one', 1.5, '\x01')::insert_row,
+    ROW(2, NULL, NULL, NULL)::insert_row,
+    ROW(NULL, 'three', 3, '\x')::insert_row]);
+SELECT * FROM sqlite_query((SELECT db FROM insert_dbs), 'SELECT id, name, score, data, typeof(data) FROM t ORDER BY rowid')
+    AS (id int, name text, score float8, data bytea, type text);
+
+-- Anonymous records, from array_agg() of a query
+UPDATE insert_dbs SET db = sqlite_insert(db, 't',
+    (SELECT array_agg(ROW(i, 'r' || i, i / 2.0, NULL)) FROM generate_series(4, 6) i));
+SELECT * FROM sqlite_query((SELECT db FROM insert_dbs), 'SELECT count(*), sum(id), group_concat(name) FROM t WHERE id > 3')
+    AS (n int, sum int, names text);
+
+-- Scalar arrays load a single column, NULL elements as NULL
+UPDATE insert_dbs SET db = sqlite_insert(db, 's', ARRAY[1, NULL, 3]);
+UPDATE insert_dbs SET db = sqlite_insert(db, 's', ARRAY[]::int[]);
+SELECT * FROM sqlite_query((SELECT db FROM insert_dbs), 'SELECT x, typeof(x) FROM s ORDER BY rowid')
+    AS (x int, type text);
+
+-- NULL rows have no attributes to bind
+SELECT sqlite_insert(db, 't', ARRAY[NULL, ROW(7, 'seven', 7, NULL)::insert_row]) FROM insert_dbs;
+SELECT sqlite_insert(db, 't', ARRAY[ROW(7, 'seven', 7, NULL)::insert_row, NULL]) FROM insert_dbs;
+SELECT sqlite_insert(db, 't', ARRAY[NULL::insert_row, NULL]) FROM insert_dbs;
+
+-- Every row must have the same type, and as many values as the table has columns
+UPDATE insert_dbs SET db = sqlite_exec(db, 'CREATE TABLE p(a, b)');
+SELECT sqlite_insert(db, 'p', ARRAY[ROW(7, 'seven'), ROW(8, 8.0)]) FROM insert_dbs;
+SELECT sqlite_insert(db, 't', ARRAY[ROW(7, 'seven')]) FROM insert_dbs;
+SELECT sqlite_insert(db, 's', ARRAY[ROW(7, 'seven', 7, NULL)::insert_row]) FROM insert_dbs;
+SELECT sqlite_insert(db, 'missing', ARRAY[1]) FROM insert_dbs;
+
+-- A row that fails to insert rolls back the rows before it
+UPDATE insert_dbs SET db = sqlite_exec(db, 'CREATE TABLE u(x UNIQUE)');
+UPDATE insert_dbs SET db = sqlite_insert(db, 'u', ARRAY[1, 2, 1]);
+SELECT * FROM sqlite_query((SELECT db FROM insert_dbs), 'SELECT count(*) FROM u') AS (n int);
+UPDATE insert_dbs SET db = sqlite_insert(db, 'u', ARRAY[1, 2]);
+SELECT * FROM sqlite_query((SELECT db FROM insert_dbs), 'SELECT group_concat(x) FROM u') AS (x text);
+
+DROP TABLE insert_dbs;
+DROP TYPE insert_row;
@@ -0,0 +1,64 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+SET sqlite.lazy_load_threshold = '64kB';
+
+-- Slices can only be read from values TOAST didn't compress
+CREATE TABLE lazy (id int, db sqlite);
+ALTER TABLE lazy ALTER db SET STORAGE external;
+INSERT INTO lazy VALUES (1, sqlite_exec('',
+    'CREATE TABLE t(i INTEGER PRIMARY KEY, s TEXT);
+     CREATE INDEX t_s ON t(s);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 20000)
+     INSERT INTO t SELECT v, printf(''%08d'', v * 7919 % 20011) FROM c'));
+SELECT pg_column_size(db) > 64 * 1024 AS above_threshold FROM lazy;
+
+-- Copies are read from the lazily read database
+SET sqlite.compression = pglz;
+INSERT INTO lazy SELECT 2, sqlite_exec(db, 'CREATE TABLE u(x)') FROM lazy WHERE id = 1;
+RESET sqlite.compression;
+INSERT INTO lazy SELECT 3, sqlite_exec(db, 'DELETE FROM t WHERE i > 10000') FROM lazy WHERE id = 1;
+
+CREATE FUNCTION lazy_queries(id int) RETURNS text LANGUAGE plpgsql AS $$
+DECLARE
+	result text;
+BEGIN
+	SELECT format('%s rows, %s', count(*), sum(length(s))) INTO result
+	  FROM lazy, sqlite_query(db, 'SELECT i, s FROM t') AS (i int, s text) WHERE lazy.id = lazy_queries.id;
+	SELECT result || format(', %s', n) INTO result
+	  FROM lazy, sqlite_query(db, 'SELECT count(*) FROM t WHERE s < ''00001000''') AS (n int) WHERE lazy.id = lazy_queries.id;
+	SELECT result || format(', %s', s) INTO result
+	  FROM lazy, sqlite_query(db, 'SELECT s FROM t WHERE i = 7777') AS (s text) WHERE lazy.id = lazy_queries.id;
+	SELECT result || format(', cached statements %s', hits) INTO result
+	  FROM sqlite_stmt_cache_stats((SELECT db FROM lazy WHERE lazy.id = lazy_queries.id));
+	RETURN result;
+END
+$$;
+
+-- Read from TOAST on demand, which is never cached
+SELECT lazy_queries(1);
+SELECT lazy_queries(1);
+SELECT lazy_queries(3);
+SELECT lazy_queries(3);
+
+-- A packed database is detoasted, and cached
+SELECT lazy_queries(2);
+SELECT lazy_queries(2);
+
+-- Parallel mode can't start the subtransactions fetches run in, so
+-- workers detoast
+SET debug_parallel_query = on;
+EXPLAIN (COSTS OFF)
+SELECT count(*), sum(i) FROM lazy, sqlite_query(db, 'SELECT i FROM t WHERE s < ''00005000''') AS (i int) WHERE id = 1;
+SELECT count(*), sum(i) FROM lazy, sqlite_query(db, 'SELECT i FROM t WHERE s < ''00005000''') AS (i int) WHERE id = 1;
+RESET debug_parallel_query;
+
+-- Detoasted up front, and cached
+SET sqlite.lazy_load_threshold = -1;
+SELECT lazy_queries(1);
+SELECT lazy_queries(1);
+
+RESET sqlite.lazy_load_threshold;
+DROP TABLE lazy;
+DROP FUNCTION lazy_queries(int);
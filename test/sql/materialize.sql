@@ -0,0 +1,43 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE materialize AS SELECT sqlite_exec('',
+    'CREATE TABLE t(x INTEGER, s TEXT);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 5000)
+     INSERT INTO t SELECT v, ''row '' || v FROM c') AS db;
+
+-- The inner function scan of a nested loop is rescanned for every outer row
+SET enable_hashjoin = off;
+SET enable_mergejoin = off;
+SET enable_material = off;
+EXPLAIN (COSTS OFF)
+SELECT g, count(*), sum(x)
+  FROM generate_series(1, 3) g, materialize, sqlite_query(db, 'SELECT x FROM t') AS q(x int)
+ WHERE x % 1000 = g
+ GROUP BY g ORDER BY g;
+SELECT g, count(*), sum(x)
+  FROM generate_series(1, 3) g, materialize, sqlite_query(db, 'SELECT x FROM t') AS q(x int)
+ WHERE x % 1000 = g
+ GROUP BY g ORDER BY g;
+RESET enable_hashjoin;
+RESET enable_mergejoin;
+RESET enable_material;
+
+-- A lateral call is run again with the outer row's values
+SELECT g, q.*
+  FROM generate_series(1, 3) g, materialize,
+       LATERAL sqlite_query(db, 'SELECT count(*), max(s) FROM t WHERE x <= ?', g * 1000) AS q(n int, s text)
+ ORDER BY g;
+
+-- Rows of a result bigger than work_mem spill to disk
+SET work_mem = '64kB';
+SELECT count(*), count(DISTINCT s), max(x) FROM materialize, sqlite_query(db, 'SELECT x, s FROM t') AS q(x int, s text);
+RESET work_mem;
+
+-- Errors while stepping stop the scan
+SELECT q.* FROM materialize,
+       sqlite_query(db, 'SELECT CASE WHEN x = 3000 THEN abs(-9223372036854775807 - 1) ELSE x END FROM t') AS q(x bigint);
+SELECT q.* FROM materialize, sqlite_query(db, 'SELECT s FROM t WHERE x < 3') AS q(x int);
+
+DROP TABLE materialize;
@@ -0,0 +1,27 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE memory AS SELECT sqlite_exec('',
+    'CREATE TABLE t(i INTEGER PRIMARY KEY, s TEXT);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 100000)
+     INSERT INTO t SELECT v, printf(''%050d'', v * 7919 % 100003) FROM c') AS db;
+
+-- Sorts and temporary b-trees count towards the limit of the database
+SET sqlite.max_memory_per_db = '2MB';
+SELECT count(*) FROM memory, sqlite_query(db, 'SELECT i, s FROM t ORDER BY s') AS (i int, s text);
+SELECT count(*) FROM memory, sqlite_query(db, 'SELECT s, count(*) FROM t GROUP BY s') AS (s text, n int);
+SELECT count(*) FROM sqlite_query('',
+    'WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 100000)
+     SELECT DISTINCT printf(''%050d'', v) FROM c') AS (s text);
+SELECT sqlite_exec(db, 'CREATE INDEX t_s ON t(s)') IS NOT NULL FROM memory;
+
+-- What fits still runs, and the memory of a failed query is returned
+SELECT count(*), min(s) FROM memory, sqlite_query(db, 'SELECT i, s FROM t WHERE i <= 1000 ORDER BY s') AS (i int, s text);
+SELECT count(*) FROM memory, sqlite_query(db, 'SELECT i FROM t') AS (i int);
+
+RESET sqlite.max_memory_per_db;
+SELECT count(*) FROM memory, sqlite_query(db, 'SELECT i, s FROM t ORDER BY s') AS (i int, s text);
+SELECT count(*) FROM memory, sqlite_query(db, 'SELECT s, count(*) FROM t GROUP BY s') AS (s text, n int);
+
+DROP TABLE memory;
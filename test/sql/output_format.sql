@@ -0,0 +1,29 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE output_format (id int, db sqlite);
+INSERT INTO output_format VALUES (1, sqlite_exec('',
+    'CREATE TABLE t(i INTEGER PRIMARY KEY, s TEXT, b BLOB);
+     CREATE INDEX t_s ON t(s);
+     INSERT INTO t VALUES (1, ''one'', x''01ff''), (2, NULL, NULL), (3, ''it''''s'', zeroblob(3))'));
+
+-- SQL text, the default
+SELECT db FROM output_format;
+
+-- The image text form
+SET sqlite.output_format = image;
+SELECT left(db::text, 14) FROM output_format;
+INSERT INTO output_format SELECT 2, db::text::sqlite FROM output_format WHERE id = 1;
+RESET sqlite.output_format;
+INSERT INTO output_format SELECT 3, db::text::sqlite FROM output_format WHERE id = 1;
+SELECT id, q.* FROM output_format, sqlite_query(db, 'SELECT i, s, b FROM t') AS q(i int, s text, b bytea)
+ ORDER BY id, i;
+SELECT id, db FROM output_format WHERE id > 1 ORDER BY id;
+
+SELECT 'sqlite+base64:AAAA'::sqlite;
+
+-- The text form depends on sqlite.output_format, so it is only stable
+SELECT provolatile FROM pg_proc WHERE oid = 'sqlite_out'::regproc;
+
+DROP TABLE output_format;
@@ -0,0 +1,71 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE pushdown AS SELECT sqlite_exec('',
+    'CREATE TABLE t(i INTEGER, f REAL, s TEXT COLLATE NOCASE, b BOOLEAN);
+     CREATE INDEX t_i ON t(i);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 1000)
+     INSERT INTO t SELECT nullif(v % 100, 7), v / 8.0,
+                          CASE v % 4 WHEN 0 THEN ''abc'' WHEN 1 THEN ''ABC'' WHEN 2 THEN ''b'' || v END,
+                          v % 2
+                     FROM c') AS db;
+
+-- Runs query with pushdown on and off and shows whether the rows match
+CREATE FUNCTION pushdown_check(query text) RETURNS text LANGUAGE plpgsql AS $$
+DECLARE
+	on_rows text;
+	off_rows text;
+BEGIN
+	PERFORM set_config('sqlite.enable_pushdown', 'on', true);
+	EXECUTE format('SELECT array_agg(q::text)::text FROM (%s) q', query) INTO on_rows;
+	PERFORM set_config('sqlite.enable_pushdown', 'off', true);
+	EXECUTE format('SELECT array_agg(q::text)::text FROM (%s) q', query) INTO off_rows;
+	PERFORM set_config('sqlite.enable_pushdown', 'on', true);
+	IF on_rows IS DISTINCT FROM off_rows THEN
+		RETURN 'differ: ' || coalesce(on_rows, 'no rows') || ' / ' || coalesce(off_rows, 'no rows');
+	END IF;
+	RETURN 'same: ' || coalesce(left(on_rows, 60), 'no rows');
+END
+$$;
+
+CREATE VIEW pushdown_t AS
+	SELECT * FROM sqlite_query((SELECT db FROM pushdown), 'SELECT i, f, s, b FROM t')
+	    AS t(i int, f float8, s text, b bool);
+
+-- Integer comparisons
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT i FROM pushdown_t WHERE i > 95 AND i <> 98;
+SELECT pushdown_check('SELECT count(*), sum(i) FROM pushdown_t WHERE i > 95 AND i <> 98');
+SELECT pushdown_check('SELECT count(*) FROM pushdown_t WHERE 5 >= i');
+SELECT pushdown_check('SELECT count(*) FROM pushdown_t WHERE i = 8');
+
+-- Doubles
+SELECT pushdown_check('SELECT count(*), sum(f) FROM pushdown_t WHERE f BETWEEN 10.5 AND 20');
+
+-- Text is compared as Postgres compares it, not with the column's NOCASE
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT s FROM pushdown_t WHERE s = 'abc';
+SELECT pushdown_check('SELECT count(*) FROM pushdown_t WHERE s = ''abc''');
+SELECT pushdown_check('SELECT s FROM pushdown_t WHERE s COLLATE "C" > ''b9'' ORDER BY s COLLATE "C"');
+SELECT pushdown_check('SELECT count(*) FROM pushdown_t WHERE s < ''b''');
+
+-- ORDER BY and LIMIT
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT i FROM pushdown_t WHERE i < 3 ORDER BY i DESC NULLS LAST, f LIMIT 5;
+SELECT pushdown_check('SELECT i, f FROM pushdown_t WHERE i < 3 ORDER BY i DESC NULLS LAST, f LIMIT 5');
+SELECT pushdown_check('SELECT i, f FROM pushdown_t ORDER BY i NULLS FIRST, f DESC LIMIT 3');
+SELECT pushdown_check('SELECT i FROM pushdown_t ORDER BY i DESC LIMIT 3 OFFSET 2');
+
+-- Booleans and expressions stay in Postgres
+EXPLAIN (VERBOSE, COSTS OFF)
+SELECT i FROM pushdown_t WHERE b AND i + 1 = 4;
+SELECT pushdown_check('SELECT count(*) FROM pushdown_t WHERE b AND i + 1 = 4');
+
+-- Statements that can't go in a CTE aren't rewritten
+SELECT pushdown_check($q$SELECT x FROM pushdown,
+    sqlite_query(db, 'PRAGMA user_version') AS t(x int) WHERE x = 0$q$);
+
+DROP VIEW pushdown_t;
+DROP FUNCTION pushdown_check(text);
+DROP TABLE pushdown;
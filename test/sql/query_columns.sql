@@ -0,0 +1,49 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE query_columns_dbs (id int, db sqlite);
+INSERT INTO query_columns_dbs VALUES (1, sqlite_exec('', $$
+    CREATE TABLE t(id INTEGER PRIMARY KEY, name TEXT, score REAL, data BLOB);
+    INSERT INTO t VALUES (1, 'one', 1.5, x'01'), (2, NULL, NULL, NULL), (3, 'three', 3, x'');
+    WITH RECURSIVE s(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM s WHERE i < 1000)
+    INSERT INTO t SELECT i + 100, 'r' || i, i / 4.0, NULL FROM s;
+$$));
+
+-- One array per column, NULLs included
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id, name, score, data FROM t WHERE id < 100 ORDER BY id')
+    AS (ids int[], names text[], scores float8[], data bytea[]);
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT NULL, NULL UNION ALL SELECT NULL, 1')
+    AS (a text[], b int8[]);
+
+-- Arrays grow past their first buffer and keep the order of the rows
+SELECT cardinality(ids), ids[1], ids[1000], names[500], scores[1000], array_position(data, NULL)
+    FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id, name, score, data FROM t WHERE id > 100 ORDER BY id DESC')
+    AS (ids int8[], names text[], scores numeric[], data bytea[]);
+
+-- No rows make empty arrays, not NULLs
+SELECT ids, names, ids IS NULL AS ids_null, cardinality(names)
+    FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id, name FROM t WHERE id < 0')
+    AS (ids int[], names text[]);
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), '') AS (ids int[]);
+
+-- Values bind to parameters and convert as in sqlite_query()
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id, name FROM t WHERE id BETWEEN ? AND ?', 2, 3)
+    AS (ids int2[], names varchar(5)[]);
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT name FROM t') AS (names int[]);
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id * 100 FROM t') AS (ids int2[]);
+
+-- Every column must be an array, and match a column of the query
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id, name FROM t')
+    AS (ids int[], names text);
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id, name FROM t')
+    AS (ids int[]);
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id FROM t')
+    AS (ids int[], names text[]);
+SELECT sqlite_query_columns((SELECT db FROM query_columns_dbs), 'SELECT id FROM t');
+
+-- NULL arguments give a NULL row
+SELECT * FROM sqlite_query_columns(NULL, 'SELECT 1') AS (a int[]);
+SELECT * FROM sqlite_query_columns((SELECT db FROM query_columns_dbs), NULL) AS (a int[]);
+
+DROP TABLE query_columns_dbs;
@@ -0,0 +1,27 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+CREATE TABLE send_recv (id int, db sqlite);
+INSERT INTO send_recv VALUES (1, sqlite_exec('',
+    'CREATE TABLE t(i INTEGER PRIMARY KEY, r REAL, s TEXT, b BLOB);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 20000)
+     INSERT INTO t SELECT v, v / 7.0, ''row '' || v, zeroblob(v % 5) FROM c'));
+
+-- Binary COPY writes the database image and reads it back
+\getenv abs_builddir PG_ABS_BUILDDIR
+\set file :abs_builddir '/results/send_recv.bin'
+COPY (SELECT 2, db FROM send_recv WHERE id = 1) TO :'file' WITH (FORMAT binary);
+COPY send_recv FROM :'file' WITH (FORMAT binary);
+SELECT id, q.* FROM send_recv,
+       sqlite_query(db, 'SELECT count(*), sum(i), sum(length(s)) + sum(length(b)) FROM t') AS q(n int, s bigint, h bigint)
+ ORDER BY id;
+SELECT sqlite_serialize(a.db) = sqlite_serialize(b.db) AS same_image
+  FROM send_recv a, send_recv b WHERE a.id = 1 AND b.id = 2;
+
+-- Anything else is refused
+\set file :abs_builddir '/results/send_recv_bad.bin'
+COPY (SELECT 3, '\x53514c6974652066'::bytea) TO :'file' WITH (FORMAT binary);
+COPY send_recv FROM :'file' WITH (FORMAT binary);
+
+DROP TABLE send_recv;
@@ -0,0 +1,55 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- Databases stored out of line stay expanded in the backend cache
+-- between statements, so their statements are reused
+CREATE TABLE stmtcache (id int, db sqlite);
+ALTER TABLE stmtcache ALTER db SET STORAGE external;
+INSERT INTO stmtcache SELECT id, sqlite_exec('',
+    'CREATE TABLE t(x, pad);
+     WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 100)
+     INSERT INTO t SELECT v, zeroblob(100) FROM c')
+  FROM generate_series(1, 3) id;
+
+CREATE FUNCTION stmtcache_query(id int, query text) RETURNS bigint LANGUAGE sql AS $$
+    SELECT sum(x) FROM stmtcache, sqlite_query(db, query) AS (x int) WHERE stmtcache.id = stmtcache_query.id
+$$;
+
+CREATE FUNCTION stmtcache_stats(id int) RETURNS TABLE (hits bigint, misses bigint, entries int) LANGUAGE sql AS $$
+    SELECT * FROM sqlite_stmt_cache_stats((SELECT db FROM stmtcache WHERE stmtcache.id = stmtcache_stats.id))
+$$;
+
+SELECT * FROM stmtcache_stats(1);
+SELECT stmtcache_query(1, 'SELECT x FROM t');
+SELECT stmtcache_query(1, 'SELECT x FROM t');
+SELECT stmtcache_query(1, 'SELECT x FROM t WHERE x > 50');
+SELECT stmtcache_query(1, 'SELECT x FROM t');
+SELECT * FROM stmtcache_stats(1);
+
+-- Every rescan of the inner function scan reuses the statement
+SELECT count(*) FROM stmtcache,
+       sqlite_query(db, 'SELECT x FROM t') AS a(x int),
+       sqlite_query(db, 'SELECT x FROM t') AS b(x int)
+ WHERE id = 1;
+SELECT * FROM stmtcache_stats(1);
+
+-- The least recently used statement is evicted
+SET sqlite.statement_cache_size = 2;
+SELECT stmtcache_query(2, 'SELECT 1');
+SELECT stmtcache_query(2, 'SELECT 2');
+SELECT stmtcache_query(2, 'SELECT 1');
+SELECT stmtcache_query(2, 'SELECT 3');
+SELECT stmtcache_query(2, 'SELECT 1');
+SELECT stmtcache_query(2, 'SELECT 2');
+SELECT * FROM stmtcache_stats(2);
+
+-- Nothing is cached
+SET sqlite.statement_cache_size = 0;
+SELECT stmtcache_query(3, 'SELECT 1');
+SELECT stmtcache_query(3, 'SELECT 1');
+SELECT * FROM stmtcache_stats(3);
+RESET sqlite.statement_cache_size;
+
+DROP TABLE stmtcache;
+DROP FUNCTION stmtcache_query(int, text), stmtcache_stats(int);
@@ -0,0 +1,23 @@
+SET client_min_messages = warning;
+CREATE EXTENSION IF NOT EXISTS sqlite;
+RESET client_min_messages;
+
+-- Only the page store of the database and anonymous temporary files can
+-- be opened, never a file on the server
+SELECT sqlite_exec('', 'ATTACH ''x.db'' AS x');
+SELECT sqlite_exec('', 'ATTACH ''file:/tmp/x.db?mode=rwc'' AS x');
+SELECT sqlite_exec('', 'CREATE TABLE t(x); VACUUM INTO ''x.db''');
+SELECT sqlite_exec('', 'PRAGMA journal_mode = DELETE; CREATE TABLE t(x)');
+
+-- An anonymous database lives in memory and goes away with the connection
+SELECT * FROM sqlite_query(
+    sqlite_exec('', 'ATTACH '''' AS scratch; CREATE TABLE scratch.s(x); INSERT INTO scratch.s VALUES (42);
+                     CREATE TABLE t AS SELECT x FROM scratch.s'),
+    'SELECT x, (SELECT count(*) FROM pragma_database_list) FROM t') AS q(x int, databases int);
+
+-- Temporary tables and large sorts use anonymous files
+SELECT count(*) FROM sqlite_query(sqlite_exec('', 'CREATE TABLE t(x)'),
+    'WITH RECURSIVE c(v) AS (SELECT 1 UNION ALL SELECT v + 1 FROM c WHERE v < 20000)
+     SELECT v FROM c ORDER BY -v') AS q(x int);
+SELECT * FROM sqlite_query(sqlite_exec('', 'CREATE TEMP TABLE tt(x); INSERT INTO tt VALUES (1)'),
+    'SELECT count(*) FROM sqlite_temp_master') AS q(n int);